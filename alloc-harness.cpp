@@ -0,0 +1,129 @@
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#include "counted-new.h"
+#include "socow-vector.h"
+
+namespace {
+
+size_t copied_bytes = 0;
+size_t moved_bytes = 0;
+
+// counts the bytes its copies and moves go through
+template <size_t ALIGN>
+struct alignas(ALIGN) element {
+    element() = default;
+
+    explicit element(size_t val) : val(val) {}
+
+    element(element const& other) : val(other.val) {
+        copied_bytes += sizeof(element);
+    }
+
+    element(element&& other) noexcept : val(other.val) {
+        moved_bytes += sizeof(element);
+    }
+
+    element& operator=(element const& other) {
+        val = other.val;
+        copied_bytes += sizeof(element);
+        return *this;
+    }
+
+    element& operator=(element&& other) noexcept {
+        val = other.val;
+        moved_bytes += sizeof(element);
+        return *this;
+    }
+
+    size_t val = 0;
+};
+
+size_t const N = 1000;
+size_t const SNAPSHOTS = 16;
+
+// keeps reads from being optimized away
+volatile size_t sink;
+
+template <typename Vector>
+Vector filled(size_t n) {
+    Vector v;
+    for (size_t i = 0; i != n; ++i) {
+        v.emplace_back(i);
+    }
+    return v;
+}
+
+// a vector is copied into many snapshots that are only read
+template <typename Vector>
+void snapshot_fan_out(Vector const& base) {
+    std::vector<Vector> snapshots(SNAPSHOTS, base);
+    size_t sum = 0;
+    for (Vector const& s : snapshots) {
+        sum += s[N / 2].val;
+    }
+    sink = sum;
+}
+
+// the same, then each snapshot has one element written
+template <typename Vector>
+void snapshot_write(Vector const& base) {
+    std::vector<Vector> snapshots(SNAPSHOTS, base);
+    for (Vector& s : snapshots) {
+        s[0].val = N;
+    }
+}
+
+template <typename Vector>
+void append_after_copy(Vector const& base) {
+    Vector copy = base;
+    copy.emplace_back(N);
+}
+
+// shrinks a heap buffer into inline storage and grows it back
+template <typename Vector>
+void shrink_and_grow(Vector const& base) {
+    Vector v = base;
+    v.resize(1);
+    v.shrink_to_fit();
+    for (size_t i = 1; i != N; ++i) {
+        v.emplace_back(i);
+    }
+}
+
+template <typename Vector, typename Scenario>
+void run(char const* scenario, char const* container, Scenario body) {
+    Vector base = filled<Vector>(N);
+    size_t live_bytes = counted_new.live_bytes;
+    counted_new = counted_new_stats();
+    counted_new.live_bytes = counted_new.peak_bytes = live_bytes;
+    copied_bytes = moved_bytes = 0;
+    body(base);
+    std::printf("%-18s %-26s %7zu %7zu %10zu %10zu %10zu\n", scenario,
+                container, counted_new.allocs, counted_new.frees,
+                counted_new.peak_bytes - live_bytes, copied_bytes,
+                moved_bytes);
+}
+
+template <typename Vector>
+void run_all(char const* container) {
+    run<Vector>("snapshot_fan_out", container, snapshot_fan_out<Vector>);
+    run<Vector>("snapshot_write", container, snapshot_write<Vector>);
+    run<Vector>("append_after_copy", container, append_after_copy<Vector>);
+    run<Vector>("shrink_and_grow", container, shrink_and_grow<Vector>);
+}
+
+} // namespace
+
+int main() {
+    // peak is the most bytes live at once on top of the original vector
+    std::printf("%-18s %-26s %7s %7s %10s %10s %10s\n", "scenario",
+                "container", "allocs", "frees", "peak", "copied", "moved");
+    run_all<std::vector<element<8>>>("std::vector");
+    run_all<socow_vector<element<8>, 4>>("socow_vector<4>");
+    run_all<socow_vector<element<8>, 64>>("socow_vector<64>");
+    run_all<std::vector<element<64>>>("std::vector, align 64");
+    run_all<socow_vector<element<64>, 4>>("socow_vector<4>, align 64");
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include <array>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "socow-vector.h"
+
+namespace {
+
+struct blob {
+    std::array<size_t, 8> words;
+};
+
+template <typename T>
+T make(size_t i);
+
+template <>
+int make<int>(size_t i) {
+    return static_cast<int>(i);
+}
+
+template <>
+std::string make<std::string>(size_t i) {
+    // too long for the small string buffer
+    return std::string(24, static_cast<char>('a' + i % 26));
+}
+
+template <>
+blob make<blob>(size_t i) {
+    blob b{};
+    b.words[0] = i;
+    return b;
+}
+
+size_t weight(int x) {
+    return static_cast<size_t>(x);
+}
+
+size_t weight(std::string const& x) {
+    return x.size();
+}
+
+size_t weight(blob const& x) {
+    return x.words[0];
+}
+
+template <typename Vector>
+Vector filled(size_t n) {
+    Vector v;
+    for (size_t i = 0; i != n; ++i) {
+        v.push_back(make<typename Vector::value_type>(i));
+    }
+    return v;
+}
+
+template <typename Vector>
+void push_back(benchmark::State& state) {
+    size_t n = state.range(0);
+    auto value = make<typename Vector::value_type>(1);
+    for (auto _ : state) {
+        Vector v;
+        for (size_t i = 0; i != n; ++i) {
+            v.push_back(value);
+        }
+        benchmark::DoNotOptimize(std::as_const(v).data());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// inserts in the middle and drops the last element to keep the size
+template <typename Vector>
+void insert(benchmark::State& state) {
+    size_t n = state.range(0);
+    Vector v = filled<Vector>(n);
+    auto value = make<typename Vector::value_type>(1);
+    for (auto _ : state) {
+        v.insert(v.begin() + n / 2, value);
+        v.pop_back();
+        benchmark::DoNotOptimize(std::as_const(v).data());
+    }
+}
+
+// erases from the middle and appends an element to keep the size
+template <typename Vector>
+void erase(benchmark::State& state) {
+    size_t n = state.range(0);
+    Vector v = filled<Vector>(n);
+    auto value = make<typename Vector::value_type>(1);
+    for (auto _ : state) {
+        v.erase(v.begin() + n / 2);
+        v.push_back(value);
+        benchmark::DoNotOptimize(std::as_const(v).data());
+    }
+}
+
+template <typename Vector>
+void copy(benchmark::State& state) {
+    size_t n = state.range(0);
+    Vector v = filled<Vector>(n);
+    for (auto _ : state) {
+        Vector c = v;
+        benchmark::DoNotOptimize(std::as_const(c).data());
+    }
+}
+
+// a copy and the first write to it, which unshares a socow_vector
+template <typename Vector>
+void copy_write(benchmark::State& state) {
+    size_t n = state.range(0);
+    Vector v = filled<Vector>(n);
+    auto value = make<typename Vector::value_type>(1);
+    for (auto _ : state) {
+        Vector c = v;
+        c[0] = value;
+        benchmark::DoNotOptimize(std::as_const(c).data());
+    }
+}
+
+// the sizes of the two vectors pick inline or heap storage for each
+template <typename Vector>
+void swap(benchmark::State& state) {
+    Vector a = filled<Vector>(state.range(0));
+    Vector b = filled<Vector>(state.range(1));
+    for (auto _ : state) {
+        a.swap(b);
+        benchmark::DoNotOptimize(std::as_const(a).data());
+        benchmark::DoNotOptimize(std::as_const(b).data());
+    }
+}
+
+template <typename Vector>
+void iterate(benchmark::State& state) {
+    size_t n = state.range(0);
+    Vector v = filled<Vector>(n);
+    for (auto _ : state) {
+        size_t sum = 0;
+        for (auto const& x : std::as_const(v)) {
+            sum += weight(x);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <typename Vector>
+void register_all(std::string const& name) {
+    auto sizes = [](benchmark::internal::Benchmark* b) {
+        b->Arg(1)->Arg(4)->Arg(16)->Arg(256)->Arg(4096);
+    };
+    benchmark::RegisterBenchmark(("push_back/" + name).c_str(),
+                                 push_back<Vector>)
+        ->Apply(sizes);
+    benchmark::RegisterBenchmark(("insert/" + name).c_str(), insert<Vector>)
+        ->Apply(sizes);
+    benchmark::RegisterBenchmark(("erase/" + name).c_str(), erase<Vector>)
+        ->Apply(sizes);
+    benchmark::RegisterBenchmark(("copy/" + name).c_str(), copy<Vector>)
+        ->Apply(sizes);
+    benchmark::RegisterBenchmark(("copy_write/" + name).c_str(),
+                                 copy_write<Vector>)
+        ->Apply(sizes);
+    benchmark::RegisterBenchmark(("swap/" + name).c_str(), swap<Vector>)
+        ->Args({1, 1})
+        ->Args({1, 4096})
+        ->Args({4096, 4096});
+    benchmark::RegisterBenchmark(("iterate/" + name).c_str(),
+                                 iterate<Vector>)
+        ->Apply(sizes);
+}
+
+template <typename T>
+void register_type(std::string const& type) {
+    register_all<std::vector<T>>("std::vector<" + type + ">");
+    register_all<socow_vector<T, 1>>("socow_vector<" + type + ", 1>");
+    register_all<socow_vector<T, 4>>("socow_vector<" + type + ", 4>");
+    register_all<socow_vector<T, 16>>("socow_vector<" + type + ", 16>");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    register_type<int>("int");
+    register_type<std::string>("string");
+    register_type<blob>("blob");
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
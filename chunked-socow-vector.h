@@ -0,0 +1,378 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "socow-vector.h"
+
+/// Vector whose elements live in refcounted chunks of CHUNK_SIZE elements,
+/// reached through a refcounted index of chunk pointers. Copies share the
+/// index, and a write to a shared vector clones only the index and the
+/// chunk it touches.
+template <typename T, size_t CHUNK_SIZE,
+          typename Policy = socow_default_policy>
+struct chunked_socow_vector {
+    static_assert(CHUNK_SIZE > 0, "chunks must hold elements");
+
+    using value_type = T;
+
+    chunked_socow_vector();
+
+    chunked_socow_vector(chunked_socow_vector const& other);
+
+    chunked_socow_vector(chunked_socow_vector&& other) noexcept;
+
+    chunked_socow_vector& operator=(chunked_socow_vector const& other);
+
+    chunked_socow_vector& operator=(chunked_socow_vector&& other) noexcept;
+
+    ~chunked_socow_vector();
+
+    T& operator[](size_t i);
+
+    T const& operator[](size_t i) const;
+
+    size_t size() const;
+
+    bool empty() const;
+
+    T& front();
+
+    T const& front() const;
+
+    T& back();
+
+    T const& back() const;
+
+    void push_back(T const& value);
+
+    void push_back(T&& value);
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args);
+
+    void pop_back();
+
+    void clear();
+
+    void swap(chunked_socow_vector& other) noexcept;
+
+private:
+    struct chunk;
+    struct index;
+
+    index* index_{nullptr};
+    size_t size_{0};
+
+    static size_t chunk_count(size_t size);
+
+    static size_t chunk_size(size_t size, size_t k);
+
+    static index* make_index(size_t cap);
+
+    static void free_index(index* idx);
+
+    static void release_chunk(chunk* c, size_t cnt);
+
+    static void release_index(index* idx, size_t size);
+
+    void reserve_index(size_t min_cap);
+
+    // makes chunk k private, keeping only its first keep elements if it has
+    // to be copied
+    T* unshare_chunk(size_t k, size_t keep);
+
+    T* unshare_chunk(size_t k);
+};
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+struct chunked_socow_vector<T, CHUNK_SIZE, Policy>::chunk {
+    T* data();
+
+    socow_ref_count<Policy::thread_safe> ref_count_;
+    std::array<std::aligned_storage_t<sizeof(T), alignof(T)>, CHUNK_SIZE> data_;
+};
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+struct chunked_socow_vector<T, CHUNK_SIZE, Policy>::index {
+    explicit index(size_t cap);
+
+    socow_ref_count<Policy::thread_safe> ref_count_;
+    size_t capacity_;
+    chunk* chunks_[];
+};
+
+/// CHUNKED SOCOW VECTOR
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::chunked_socow_vector() = default;
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::chunked_socow_vector(
+    chunked_socow_vector const& other)
+    : index_(other.index_), size_(other.size_) {
+    if (index_ != nullptr) {
+        index_->ref_count_.retain();
+    }
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::chunked_socow_vector(
+    chunked_socow_vector&& other) noexcept
+    : index_(other.index_), size_(other.size_) {
+    other.index_ = nullptr;
+    other.size_ = 0;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+chunked_socow_vector<T, CHUNK_SIZE, Policy>&
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::operator=(
+    chunked_socow_vector const& other) {
+    chunked_socow_vector(other).swap(*this);
+    return *this;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+chunked_socow_vector<T, CHUNK_SIZE, Policy>&
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::operator=(
+    chunked_socow_vector&& other) noexcept {
+    chunked_socow_vector(std::move(other)).swap(*this);
+    return *this;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::~chunked_socow_vector() {
+    clear();
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T& chunked_socow_vector<T, CHUNK_SIZE, Policy>::operator[](size_t i) {
+    reserve_index(chunk_count(size_));
+    return unshare_chunk(i / CHUNK_SIZE)[i % CHUNK_SIZE];
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T const&
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::operator[](size_t i) const {
+    return index_->chunks_[i / CHUNK_SIZE]->data()[i % CHUNK_SIZE];
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+size_t chunked_socow_vector<T, CHUNK_SIZE, Policy>::size() const {
+    return size_;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+bool chunked_socow_vector<T, CHUNK_SIZE, Policy>::empty() const {
+    return size_ == 0;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T& chunked_socow_vector<T, CHUNK_SIZE, Policy>::front() {
+    return (*this)[0];
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T const& chunked_socow_vector<T, CHUNK_SIZE, Policy>::front() const {
+    return (*this)[0];
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T& chunked_socow_vector<T, CHUNK_SIZE, Policy>::back() {
+    return (*this)[size_ - 1];
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T const& chunked_socow_vector<T, CHUNK_SIZE, Policy>::back() const {
+    return (*this)[size_ - 1];
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::push_back(T const& value) {
+    emplace_back(value);
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::push_back(T&& value) {
+    emplace_back(std::move(value));
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+template <typename... Args>
+T& chunked_socow_vector<T, CHUNK_SIZE, Policy>::emplace_back(Args&&... args) {
+    // args may refer to an element of a chunk that gets unshared here, the
+    // other owners of that chunk keep it alive
+    size_t k = size_ / CHUNK_SIZE, offset = size_ % CHUNK_SIZE;
+    reserve_index(k + 1);
+    T* dst;
+    if (offset == 0) {
+        // default-initialized, the elements are constructed one by one
+        chunk* c = new chunk;
+        try {
+            dst = new (c->data()) T(std::forward<Args>(args)...);
+        } catch (...) {
+            delete c;
+            throw;
+        }
+        index_->chunks_[k] = c;
+    } else {
+        dst = new (unshare_chunk(k) + offset) T(std::forward<Args>(args)...);
+    }
+    ++size_;
+    return *dst;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::pop_back() {
+    size_t k = (size_ - 1) / CHUNK_SIZE, offset = (size_ - 1) % CHUNK_SIZE;
+    reserve_index(chunk_count(size_));
+    if (offset == 0) {
+        release_chunk(index_->chunks_[k], 1);
+    } else if (!index_->chunks_[k]->ref_count_.unique()) {
+        // copy only the elements that survive
+        unshare_chunk(k, offset);
+    } else {
+        index_->chunks_[k]->data()[offset].~T();
+    }
+    --size_;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::clear() {
+    if (index_ != nullptr) {
+        release_index(index_, size_);
+        index_ = nullptr;
+        size_ = 0;
+    }
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::swap(
+    chunked_socow_vector& other) noexcept {
+    std::swap(index_, other.index_);
+    std::swap(size_, other.size_);
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+size_t chunked_socow_vector<T, CHUNK_SIZE, Policy>::chunk_count(size_t size) {
+    return (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+size_t chunked_socow_vector<T, CHUNK_SIZE, Policy>::chunk_size(size_t size,
+                                                               size_t k) {
+    return std::min(CHUNK_SIZE, size - k * CHUNK_SIZE);
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+typename chunked_socow_vector<T, CHUNK_SIZE, Policy>::index*
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::make_index(size_t cap) {
+    void* ptr = ::operator new(sizeof(index) + cap * sizeof(chunk*));
+    return new (ptr) index(cap);
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::free_index(index* idx) {
+    idx->~index();
+    ::operator delete(idx);
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::release_chunk(chunk* c,
+                                                                size_t cnt) {
+    if (c->ref_count_.release()) {
+        T* data = c->data();
+        for (size_t i = 0; i != cnt; ++i) {
+            data[i].~T();
+        }
+        delete c;
+    }
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::release_index(index* idx,
+                                                                size_t size) {
+    // vectors sharing an index or a chunk have the same elements in it,
+    // so any owner can tell how many of them to destroy
+    if (idx->ref_count_.release()) {
+        for (size_t k = 0; k != chunk_count(size); ++k) {
+            release_chunk(idx->chunks_[k], chunk_size(size, k));
+        }
+        free_index(idx);
+    }
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+void chunked_socow_vector<T, CHUNK_SIZE, Policy>::reserve_index(
+    size_t min_cap) {
+    if (index_ == nullptr ? min_cap == 0
+                          : index_->ref_count_.unique() &&
+                                index_->capacity_ >= min_cap) {
+        return;
+    }
+    size_t new_cap = min_cap;
+    if (index_ != nullptr) {
+        new_cap = std::max(new_cap, index_->capacity_ < min_cap
+                                        ? index_->capacity_ << 1
+                                        : index_->capacity_);
+    }
+    index* new_index = make_index(new_cap);
+    if (index_ != nullptr) {
+        size_t cnt = chunk_count(size_);
+        std::copy_n(index_->chunks_, cnt, new_index->chunks_);
+        if (index_->ref_count_.unique()) {
+            // the chunks move over to the new index with their references
+            free_index(index_);
+        } else {
+            for (size_t k = 0; k != cnt; ++k) {
+                new_index->chunks_[k]->ref_count_.retain();
+            }
+            release_index(index_, size_);
+        }
+    }
+    index_ = new_index;
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T* chunked_socow_vector<T, CHUNK_SIZE, Policy>::unshare_chunk(size_t k,
+                                                              size_t keep) {
+    chunk* c = index_->chunks_[k];
+    if (!c->ref_count_.unique()) {
+        chunk* copy = new chunk;
+        T* dst = copy->data();
+        size_t i = 0;
+        try {
+            for (; i != keep; ++i) {
+                new (dst + i) T(c->data()[i]);
+            }
+        } catch (...) {
+            while (i != 0) {
+                dst[--i].~T();
+            }
+            delete copy;
+            throw;
+        }
+        index_->chunks_[k] = copy;
+        release_chunk(c, chunk_size(size_, k));
+        c = copy;
+    }
+    return c->data();
+}
+
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T* chunked_socow_vector<T, CHUNK_SIZE, Policy>::unshare_chunk(size_t k) {
+    return unshare_chunk(k, chunk_size(size_, k));
+}
+
+/// CHUNK
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+T* chunked_socow_vector<T, CHUNK_SIZE, Policy>::chunk::data() {
+    return reinterpret_cast<T*>(&data_[0]);
+}
+
+/// INDEX
+template <typename T, size_t CHUNK_SIZE, typename Policy>
+chunked_socow_vector<T, CHUNK_SIZE, Policy>::index::index(size_t cap)
+    : capacity_(cap) {}
@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+// replaces the global allocation functions with ones that count calls and
+// bytes, every block is prefixed by its size. Meant for the tools, include
+// it in exactly one source file of a program
+struct counted_new_stats {
+    size_t allocs = 0;
+    size_t frees = 0;
+    size_t bytes = 0; // allocated in total
+    size_t live_bytes = 0;
+    size_t peak_bytes = 0;
+};
+
+inline counted_new_stats counted_new;
+
+inline size_t counted_new_header_size(size_t align) {
+    return std::max(align, alignof(std::max_align_t));
+}
+
+inline void* counted_new_allocate(size_t bytes, size_t align) {
+    size_t head = counted_new_header_size(align);
+    size_t total = (bytes + head + align - 1) / align * align;
+#if defined(_MSC_VER)
+    // blocks from _aligned_malloc have to go back to _aligned_free
+    void* base = _aligned_malloc(total, head);
+#else
+    void* base = align > alignof(std::max_align_t)
+                     ? std::aligned_alloc(align, total)
+                     : std::malloc(total);
+#endif
+    if (base == nullptr) {
+        throw std::bad_alloc();
+    }
+    char* ptr = static_cast<char*>(base) + head;
+    reinterpret_cast<size_t*>(ptr)[-1] = bytes;
+    ++counted_new.allocs;
+    counted_new.bytes += bytes;
+    counted_new.live_bytes += bytes;
+    counted_new.peak_bytes =
+        std::max(counted_new.peak_bytes, counted_new.live_bytes);
+    return ptr;
+}
+
+inline void counted_new_deallocate(void* ptr, size_t align) {
+    if (ptr == nullptr) {
+        return;
+    }
+    ++counted_new.frees;
+    counted_new.live_bytes -= static_cast<size_t*>(ptr)[-1];
+    void* base = static_cast<char*>(ptr) - counted_new_header_size(align);
+#if defined(_MSC_VER)
+    _aligned_free(base);
+#else
+    std::free(base);
+#endif
+}
+
+void* operator new(size_t bytes) {
+    return counted_new_allocate(bytes, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t bytes) {
+    return counted_new_allocate(bytes, alignof(std::max_align_t));
+}
+
+void* operator new(size_t bytes, std::align_val_t align) {
+    return counted_new_allocate(bytes, static_cast<size_t>(align));
+}
+
+void* operator new[](size_t bytes, std::align_val_t align) {
+    return counted_new_allocate(bytes, static_cast<size_t>(align));
+}
+
+void operator delete(void* ptr) noexcept {
+    counted_new_deallocate(ptr, alignof(std::max_align_t));
+}
+
+void operator delete[](void* ptr) noexcept {
+    counted_new_deallocate(ptr, alignof(std::max_align_t));
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    counted_new_deallocate(ptr, alignof(std::max_align_t));
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    counted_new_deallocate(ptr, alignof(std::max_align_t));
+}
+
+void operator delete(void* ptr, std::align_val_t align) noexcept {
+    counted_new_deallocate(ptr, static_cast<size_t>(align));
+}
+
+void operator delete[](void* ptr, std::align_val_t align) noexcept {
+    counted_new_deallocate(ptr, static_cast<size_t>(align));
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t align) noexcept {
+    counted_new_deallocate(ptr, static_cast<size_t>(align));
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t align) noexcept {
+    counted_new_deallocate(ptr, static_cast<size_t>(align));
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "socow-vector.h"
+
+/// Header of an archive of vectors. Each vector follows as a record: a
+/// uint64_t buffer id, then the uint64_t size and the elements unless the
+/// id was seen before. Id 0 stands for a buffer shared with no other vector
+/// of the archive, ids of shared buffers count up from 1 in the order they
+/// first appear. Fields are in the byte order of the writer.
+struct socow_archive_header {
+    static constexpr char MAGIC[8] = {'S', 'O', 'C', 'O', 'W', 'A', 'R', 'C'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t endian_mark;
+    uint64_t element_size;
+    uint64_t element_align;
+};
+
+/// Writes vectors of trivially copyable elements to fd, each buffer shared
+/// by several of them only once. The writer keeps a copy of every shared
+/// vector it has written, so their buffers stay alive, and ref_count() of
+/// the vectors stays one higher, until the writer is destroyed.
+template <typename Vector>
+struct socow_archive_writer {
+    using value_type = typename Vector::value_type;
+
+    static_assert(std::is_trivially_copyable_v<value_type>,
+                  "only trivially copyable elements can be archived");
+
+    explicit socow_archive_writer(int fd);
+
+    void write(Vector const& vec);
+
+private:
+    int fd_;
+    std::unordered_map<value_type const*, uint64_t> ids_;
+    // holds on to the shared buffers written so far, so that none of them
+    // is freed and its address reused by another buffer
+    std::vector<Vector> written_;
+};
+
+/// Reads the vectors socow_archive_writer wrote, in the same order. Vectors
+/// that shared a buffer when they were written share one again. The reader
+/// holds a reference to each shared buffer, so ref_count() of the vectors
+/// is one more than when they were written until the reader is destroyed.
+template <typename Vector>
+struct socow_archive_reader {
+    using value_type = typename Vector::value_type;
+
+    static_assert(std::is_trivially_copyable_v<value_type>,
+                  "only trivially copyable elements can be archived");
+
+    explicit socow_archive_reader(int fd);
+
+    Vector read();
+
+private:
+    int fd_;
+    std::vector<Vector> buffers_;
+};
+
+/// ARCHIVE WRITER
+template <typename Vector>
+socow_archive_writer<Vector>::socow_archive_writer(int fd) : fd_(fd) {
+    socow_archive_header header;
+    std::memcpy(header.magic, socow_archive_header::MAGIC,
+                sizeof(header.magic));
+    header.version = socow_archive_header::VERSION;
+    header.endian_mark = socow_archive_header::ENDIAN_MARK;
+    header.element_size = sizeof(value_type);
+    header.element_align = alignof(value_type);
+    socow_write_all(fd_, &header, sizeof(header));
+}
+
+template <typename Vector>
+void socow_archive_writer<Vector>::write(Vector const& vec) {
+    // the buffer id and the size
+    uint64_t head[2] = {0, vec.size()};
+    if (vec.ref_count() > 1) {
+        auto [it, inserted] = ids_.emplace(vec.data(), written_.size() + 1);
+        head[0] = it->second;
+        if (!inserted) {
+            socow_write_all(fd_, &head[0], sizeof(head[0]));
+            return;
+        }
+        written_.push_back(vec);
+    }
+    socow_write_all(fd_, head, sizeof(head));
+    socow_write_all(fd_, vec.data(), vec.size() * sizeof(value_type));
+}
+
+/// ARCHIVE READER
+template <typename Vector>
+socow_archive_reader<Vector>::socow_archive_reader(int fd) : fd_(fd) {
+    socow_archive_header header;
+    socow_read_all(fd_, &header, sizeof(header));
+    if (std::memcmp(header.magic, socow_archive_header::MAGIC,
+                    sizeof(header.magic)) != 0 ||
+        header.endian_mark != socow_archive_header::ENDIAN_MARK) {
+        throw std::runtime_error("socow_archive: not an archive");
+    }
+    if (header.version != socow_archive_header::VERSION) {
+        throw std::runtime_error("socow_archive: unsupported version");
+    }
+    if (header.element_size != sizeof(value_type) ||
+        header.element_align != alignof(value_type)) {
+        throw std::runtime_error("socow_archive: element type mismatch");
+    }
+}
+
+template <typename Vector>
+Vector socow_archive_reader<Vector>::read() {
+    uint64_t id;
+    socow_read_all(fd_, &id, sizeof(id));
+    if (id != 0 && id <= buffers_.size()) {
+        return buffers_[id - 1];
+    }
+    if (id > buffers_.size() + 1) {
+        throw std::runtime_error("socow_archive: bad buffer id");
+    }
+    uint64_t size;
+    socow_read_all(fd_, &size, sizeof(size));
+    if (size > std::numeric_limits<size_t>::max() / 2 / sizeof(value_type)) {
+        throw std::runtime_error("socow_archive: bad size");
+    }
+    Vector vec;
+    vec.resize_default_init(static_cast<size_t>(size));
+    socow_read_all(fd_, vec.data(), vec.size() * sizeof(value_type));
+    if (id != 0) {
+        buffers_.push_back(vec);
+    }
+    return vec;
+}
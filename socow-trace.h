@@ -0,0 +1,173 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "socow-vector.h"
+
+/// Header of a trace written by socow_trace_recorder, followed by records.
+struct socow_trace_header {
+    static constexpr char MAGIC[8] = {'S', 'O', 'C', 'O', 'W', 'T', 'R', 'C'};
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+/// One operation of a trace. Vectors are numbered from 1 in the order they
+/// are first seen, a number is reused once its vector is destroyed. Sizes
+/// are clamped to 32 bits.
+struct socow_trace_record {
+    static constexpr uint8_t SHARED = 1;
+    static constexpr uint8_t STATIC = 2;
+
+    uint8_t op; // a socow_op
+    uint8_t flags;
+    uint16_t element_size;
+    uint32_t id;
+    uint32_t other; // 0 if there is none
+    uint32_t size;
+    uint32_t pos;
+    uint32_t count;
+};
+
+/// Writes the operations of every vector using socow_traced_policy to a
+/// file while it is started. Recording stops by itself if a write fails.
+struct socow_trace_recorder {
+    // writes the header to fd, which stays owned by the caller
+    static void start(int fd);
+
+    // writes the records still buffered
+    static void stop();
+
+    static void record(socow_trace_event const& event) noexcept;
+
+private:
+    static constexpr size_t BUFFER_RECORDS = 4096;
+
+    struct state {
+        std::mutex mutex;
+        int fd = -1;
+        std::vector<socow_trace_record> buffer;
+        std::unordered_map<void const*, uint32_t> ids;
+        std::vector<uint32_t> free_ids;
+        uint32_t next_id = 1;
+    };
+
+    static state& get_state();
+
+    static uint32_t id_of(state& st, void const* vec);
+
+    static void flush(state& st);
+};
+
+/// Reports every operation to socow_trace_recorder.
+template <typename Base = socow_default_policy>
+struct socow_traced_policy : Base {
+    static constexpr bool traced = true;
+
+    static void trace(socow_trace_event const& event) noexcept;
+};
+
+/// TRACE RECORDER
+inline void socow_trace_recorder::start(int fd) {
+    state& st = get_state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    socow_trace_header header;
+    std::memcpy(header.magic, socow_trace_header::MAGIC, sizeof(header.magic));
+    header.version = socow_trace_header::VERSION;
+    header.record_size = sizeof(socow_trace_record);
+    socow_write_all(fd, &header, sizeof(header));
+    st.fd = fd;
+    st.buffer.reserve(BUFFER_RECORDS);
+    st.ids.clear();
+    st.free_ids.clear();
+    st.next_id = 1;
+}
+
+inline void socow_trace_recorder::stop() {
+    state& st = get_state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    if (st.fd >= 0) {
+        flush(st);
+        st.fd = -1;
+    }
+}
+
+inline void socow_trace_recorder::record(
+    socow_trace_event const& event) noexcept {
+    state& st = get_state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    if (st.fd < 0) {
+        return;
+    }
+    auto clamp = [](size_t value) {
+        return static_cast<uint32_t>(std::min<size_t>(
+            value, std::numeric_limits<uint32_t>::max()));
+    };
+    try {
+        socow_trace_record rec;
+        rec.op = static_cast<uint8_t>(event.op);
+        rec.flags = (event.shared ? socow_trace_record::SHARED : 0) |
+                    (event.is_static ? socow_trace_record::STATIC : 0);
+        rec.element_size = static_cast<uint16_t>(std::min<size_t>(
+            event.element_size, std::numeric_limits<uint16_t>::max()));
+        rec.id = id_of(st, event.vec);
+        rec.other = event.other == nullptr ? 0 : id_of(st, event.other);
+        rec.size = clamp(event.size);
+        rec.pos = clamp(event.pos);
+        rec.count = clamp(event.count);
+        if (event.op == socow_op::destroy) {
+            st.ids.erase(event.vec);
+            st.free_ids.push_back(rec.id);
+        }
+        st.buffer.push_back(rec);
+        if (st.buffer.size() == BUFFER_RECORDS) {
+            flush(st);
+        }
+    } catch (...) {
+        // out of memory or a failed write, the trace ends here
+        st.fd = -1;
+        st.buffer.clear();
+    }
+}
+
+inline socow_trace_recorder::state& socow_trace_recorder::get_state() {
+    static state st;
+    return st;
+}
+
+inline uint32_t socow_trace_recorder::id_of(state& st, void const* vec) {
+    auto it = st.ids.find(vec);
+    if (it != st.ids.end()) {
+        return it->second;
+    }
+    uint32_t id;
+    if (st.free_ids.empty()) {
+        id = st.next_id++;
+    } else {
+        id = st.free_ids.back();
+        st.free_ids.pop_back();
+    }
+    st.ids.emplace(vec, id);
+    return id;
+}
+
+inline void socow_trace_recorder::flush(state& st) {
+    socow_write_all(st.fd, st.buffer.data(),
+                    st.buffer.size() * sizeof(socow_trace_record));
+    st.buffer.clear();
+}
+
+/// TRACED POLICY
+template <typename Base>
+void socow_traced_policy<Base>::trace(
+    socow_trace_event const& event) noexcept {
+    socow_trace_recorder::record(event);
+}
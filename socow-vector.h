@@ -1,27 +1,820 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <new>
+#include <stdexcept>
+#include <system_error>
 #include <type_traits>
+#include <utility>
+
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif __has_include(<malloc.h>)
+#include <malloc.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#endif
+
+/// Customization point: specialize as std::true_type for types whose objects
+/// can be moved to another address by copying their bytes, after which the
+/// source is not destroyed.
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+template <typename T>
+inline constexpr bool is_trivially_relocatable_v =
+    is_trivially_relocatable<T>::value;
+
+template <typename T>
+struct is_trivially_relocatable<std::allocator<T>> : std::true_type {};
+
+#if __has_include(<memory_resource>)
+template <typename T>
+struct is_trivially_relocatable<std::pmr::polymorphic_allocator<T>>
+    : std::true_type {};
+#endif
+
+/// Default policy: reference counts are plain integers, so vectors sharing a
+/// buffer must not be used from different threads. A full buffer grows to
+/// twice its capacity, and buffers get exactly the capacity asked for. A
+/// shared buffer is unshared into the same capacity, or into half of it if
+/// at most a quarter is used.
+struct socow_default_policy {
+    static constexpr bool thread_safe = false;
+    static constexpr bool pooled = false;
+    static constexpr bool round_to_usable_size = false;
+    static constexpr size_t memfd_threshold = 0;
+    static constexpr bool mapped_files = false;
+    static constexpr bool traced = false;
+    static constexpr bool counted = false;
+
+    // capacity to grow a full buffer of capacity cap to, at least cap + 1
+    static constexpr size_t grow(size_t cap);
+
+    // capacity of the private copy of size elements made when a shared
+    // buffer of capacity cap is modified, anything up to small_size keeps
+    // the elements inline
+    static constexpr size_t unshare_capacity(size_t size, size_t cap,
+                                             size_t small_size);
+};
+
+constexpr size_t socow_default_policy::grow(size_t cap) {
+    return cap << 1;
+}
+
+constexpr size_t socow_default_policy::unshare_capacity(size_t size,
+                                                        size_t cap,
+                                                        size_t small_size) {
+    if (size > small_size) {
+        if ((size << 2) > cap) {
+            return cap;
+        } else {
+            return (cap + 1) >> 1;
+        }
+    } else {
+        return small_size;
+    }
+}
+
+/// Reference counts are atomic, so copies of one vector may be handed to
+/// different threads, each of which may read or modify its own copy.
+struct socow_thread_safe_policy : socow_default_policy {
+    static constexpr bool thread_safe = true;
+};
+
+/// Freed buffers of up to pool_max_block_bytes are kept in per-thread free
+/// lists, one per power-of-two size class, and handed out again to vectors
+/// of any type with the same policy. At most pool_max_bytes are retained by
+/// each thread. Only vectors using std::allocator are pooled.
+struct socow_pooled_policy : socow_default_policy {
+    static constexpr bool pooled = true;
+    static constexpr size_t pool_max_bytes = size_t(1) << 20;
+    static constexpr size_t pool_max_block_bytes = size_t(1) << 16;
+};
+
+/// Grows full buffers by NUM / DEN instead of doubling them, e.g. 3 / 2 for
+/// a smaller footprint at the cost of more reallocations.
+template <size_t NUM, size_t DEN, typename Base = socow_default_policy>
+struct socow_growth_policy : Base {
+    static_assert(NUM > DEN, "growth factor must be greater than one");
+
+    static constexpr size_t grow(size_t cap);
+};
+
+/// Unshared copies keep the capacity of the shared buffer.
+template <typename Base = socow_default_policy>
+struct socow_unshare_keep_policy : Base {
+    static constexpr size_t unshare_capacity(size_t size, size_t cap,
+                                             size_t small_size);
+};
+
+/// Unshared copies are shrunk to fit, for snapshots that are mostly read.
+template <typename Base = socow_default_policy>
+struct socow_unshare_shrink_policy : Base {
+    static constexpr size_t unshare_capacity(size_t size, size_t cap,
+                                             size_t small_size);
+};
+
+/// Unshared copies get room for size * NUM / DEN elements, for snapshots
+/// that are appended to right away.
+template <size_t NUM, size_t DEN, typename Base = socow_default_policy>
+struct socow_unshare_grow_policy : Base {
+    static constexpr size_t unshare_capacity(size_t size, size_t cap,
+                                             size_t small_size);
+};
+
+/// Buffers of vectors using std::allocator are allocated with malloc, and
+/// their capacity is extended over the whole block malloc_usable_size (or
+/// the platform's equivalent) reports, so the allocator's size-class slack
+/// is used instead of wasted. This also covers jemalloc and tcmalloc when
+/// they replace malloc.
+template <typename Base = socow_default_policy>
+struct socow_usable_size_policy : Base {
+    static constexpr bool round_to_usable_size = true;
+};
+
+/// Buffers of at least THRESHOLD bytes of trivially copyable elements are
+/// kept in a memfd instead of on the heap (Linux only, std::allocator only).
+/// A shared buffer is unshared by mapping the same file again with
+/// MAP_PRIVATE, so the kernel copies only the pages that get written. Once
+/// that has happened, the next write through the buffer itself remaps it
+/// privately in place and lets go of the file, and a buffer written to
+/// after that is unshared by copying, as usual.
+template <size_t THRESHOLD = (size_t(1) << 24),
+          typename Base = socow_default_policy>
+struct socow_memfd_policy : Base {
+    static_assert(THRESHOLD > 0, "zero disables memfd buffers");
+
+    static constexpr size_t memfd_threshold = THRESHOLD;
+};
+
+/// socow_vector::load maps the file it reads (Linux only, std::allocator
+/// only) instead of copying the elements to the heap. The mapping is
+/// private, so writes never reach the file: a vector that is its only owner
+/// writes to it in place and the kernel copies the pages written, one that
+/// shares it copies the elements to the heap first. Pages not yet written
+/// are read from the file itself, so it must not be changed while loaded.
+template <typename Base = socow_default_policy>
+struct socow_mapped_file_policy : Base {
+    static constexpr bool mapped_files = true;
+};
+
+/// Vectors count their unshares, reallocations and moves between inline
+/// and heap storage in socow_counters.
+template <typename Base = socow_default_policy>
+struct socow_counted_policy : Base {
+    static constexpr bool counted = true;
+};
+
+/// Where a buffer kept in a memfd or loaded from a file is mapped, empty
+/// unless either is enabled.
+template <bool MAPPED>
+struct socow_mapping {};
+
+template <>
+struct socow_mapping<true> {
+    int fd_ = -1; // the memfd of a MAP_SHARED buffer, -1 for any other
+    std::atomic<bool> map_copied_{false}; // the memfd has been mapped again
+    size_t offset_ = 0; // of the header from the start of the mapping
+    size_t length_ = 0; // 0 for buffers on the heap
+};
+
+/// Header of a file written by socow_vector::save. The elements follow at
+/// data_offset. Fields are in the byte order of the writer, so a file does
+/// not load on a machine of the other byte order.
+struct socow_file_header {
+    static constexpr char MAGIC[8] = {'S', 'O', 'C', 'O', 'W', 'V', 'E', 'C'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+    // leaves room for the header of a mapped buffer right before the data
+    static constexpr uint64_t DATA_OFFSET = 4096;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t endian_mark;
+    uint64_t data_offset;
+    uint64_t size;
+    uint64_t element_size;
+    uint64_t element_align;
+};
+
+/// Writes all bytes to fd, throws std::system_error on failure.
+inline void socow_write_all(int fd, void const* buf, size_t bytes) {
+#if __has_include(<unistd.h>)
+    auto* ptr = static_cast<char const*>(buf);
+    while (bytes > 0) {
+        ssize_t written = write(fd, ptr, bytes);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(),
+                                    "socow_vector: write");
+        }
+        ptr += written;
+        bytes -= static_cast<size_t>(written);
+    }
+#else
+    (void)fd;
+    (void)buf;
+    (void)bytes;
+    throw std::system_error(
+        std::make_error_code(std::errc::function_not_supported));
+#endif
+}
+
+/// Reads exactly bytes from fd, throws std::system_error on failure and
+/// std::runtime_error if the file ends first.
+inline void socow_read_all(int fd, void* buf, size_t bytes) {
+#if __has_include(<unistd.h>)
+    auto* ptr = static_cast<char*>(buf);
+    while (bytes > 0) {
+        ssize_t got = read(fd, ptr, bytes);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(),
+                                    "socow_vector: read");
+        }
+        if (got == 0) {
+            throw std::runtime_error("socow_vector: truncated file");
+        }
+        ptr += got;
+        bytes -= static_cast<size_t>(got);
+    }
+#else
+    (void)fd;
+    (void)buf;
+    (void)bytes;
+    throw std::system_error(
+        std::make_error_code(std::errc::function_not_supported));
+#endif
+}
+
+/// Whether fd is a regular file positioned at a page boundary, which is
+/// then stored in pos along with the size of the file.
+inline bool socow_mappable(int fd, size_t& pos, size_t& size) {
+#if defined(__linux__)
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    off_t cur = lseek(fd, 0, SEEK_CUR);
+    if (cur < 0 || cur % static_cast<off_t>(sysconf(_SC_PAGESIZE)) != 0) {
+        return false;
+    }
+    pos = static_cast<size_t>(cur);
+    size = static_cast<size_t>(st.st_size);
+    return true;
+#else
+    (void)fd;
+    (void)pos;
+    (void)size;
+    return false;
+#endif
+}
+
+/// Moves fd to pos, throws std::system_error on failure.
+inline void socow_seek(int fd, size_t pos) {
+#if __has_include(<unistd.h>)
+    if (lseek(fd, static_cast<off_t>(pos), SEEK_SET) < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "socow_vector: lseek");
+    }
+#else
+    (void)fd;
+    (void)pos;
+    throw std::system_error(
+        std::make_error_code(std::errc::function_not_supported));
+#endif
+}
+
+/// Creates a memfd of length bytes and maps it with MAP_SHARED, nullptr if
+/// that is not supported.
+inline void* socow_map_memfd(size_t length, int& fd) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    fd = memfd_create("socow-vector", MFD_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    void* ptr = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(length)) == 0) {
+        ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+    }
+    return ptr;
+#else
+    (void)length;
+    (void)fd;
+    return nullptr;
+#endif
+}
+
+/// Maps length bytes of fd from file_offset with MAP_PRIVATE, nullptr if
+/// that fails. The mapping does not need fd to stay open.
+inline void* socow_map_private(int fd, size_t length, size_t file_offset = 0) {
+#if defined(__linux__)
+    void* ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                     static_cast<off_t>(file_offset));
+    return ptr == MAP_FAILED ? nullptr : ptr;
+#else
+    (void)fd;
+    (void)length;
+    (void)file_offset;
+    return nullptr;
+#endif
+}
+
+/// Replaces the length bytes mapped at addr with a MAP_PRIVATE mapping of
+/// fd, which holds the same bytes if addr maps fd with MAP_SHARED. The old
+/// mapping is left as it was if this fails.
+inline bool socow_remap_private(int fd, void* addr, size_t length) {
+#if defined(__linux__)
+    void* ptr = socow_map_private(fd, length);
+    if (ptr == nullptr) {
+        return false;
+    }
+    // moved over the old mapping in one step, which mmap with MAP_FIXED
+    // does not promise
+    if (mremap(ptr, length, length, MREMAP_MAYMOVE | MREMAP_FIXED, addr) ==
+        MAP_FAILED) {
+        munmap(ptr, length);
+        return false;
+    }
+    return true;
+#else
+    (void)fd;
+    (void)addr;
+    (void)length;
+    return false;
+#endif
+}
+
+inline void socow_close(int fd) {
+#if defined(__linux__)
+    close(fd);
+#else
+    (void)fd;
+#endif
+}
+
+inline void socow_unmap(void* addr, size_t length, int fd) {
+#if defined(__linux__)
+    munmap(addr, length);
+    if (fd >= 0) {
+        close(fd);
+    }
+#else
+    (void)addr;
+    (void)length;
+    (void)fd;
+#endif
+}
+
+inline size_t socow_page_size() {
+#if defined(__linux__)
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 4096;
+#endif
+}
+
+/// Number of bytes usable in the block of malloc(bytes) at ptr.
+inline size_t socow_usable_size(void* ptr, [[maybe_unused]] size_t bytes) {
+#if defined(__APPLE__)
+    return malloc_size(ptr);
+#elif defined(_WIN32)
+    return _msize(ptr);
+#elif defined(__linux__) || defined(__FreeBSD__)
+    return malloc_usable_size(ptr);
+#else
+    return bytes;
+#endif
+}
+
+template <size_t NUM, size_t DEN, typename Base>
+constexpr size_t socow_growth_policy<NUM, DEN, Base>::grow(size_t cap) {
+    return cap + std::max<size_t>(cap / DEN * (NUM - DEN), 1);
+}
+
+template <typename Base>
+constexpr size_t
+socow_unshare_keep_policy<Base>::unshare_capacity(size_t, size_t cap, size_t) {
+    return cap;
+}
+
+template <typename Base>
+constexpr size_t
+socow_unshare_shrink_policy<Base>::unshare_capacity(size_t size, size_t,
+                                                    size_t) {
+    return size;
+}
+
+template <size_t NUM, size_t DEN, typename Base>
+constexpr size_t
+socow_unshare_grow_policy<NUM, DEN, Base>::unshare_capacity(size_t size,
+                                                            size_t, size_t) {
+    return size / DEN * NUM + size % DEN * NUM / DEN;
+}
+
+/// Reference count of a shared buffer, starting at one. It is atomic when
+/// THREAD_SAFE is set.
+template <bool THREAD_SAFE>
+struct socow_ref_count {
+    socow_ref_count();
+
+    bool unique() const;
+
+    size_t count() const;
+
+    void retain();
+
+    // drops a reference, true if it was the last one
+    bool release();
+
+private:
+    std::conditional_t<THREAD_SAFE, std::atomic<size_t>, size_t> count_;
+};
+
+/// Operations a vector reports to Policy::trace when Policy::traced is set.
+enum class socow_op : uint8_t {
+    create,
+    copy,
+    assign,
+    move,
+    move_assign,
+    destroy,
+    write, // only a write that unshares the buffer
+    append,
+    pop,
+    insert,
+    erase,
+    resize,
+    reserve,
+    shrink,
+    clear,
+    swap,
+};
+
+/// An operation on vec, with the state of vec right before it, or right
+/// after it for the constructors.
+struct socow_trace_event {
+    socow_op op;
+    void const* vec;
+    void const* other; // the source of a copy or move, the other of a swap
+    size_t element_size;
+    size_t size;
+    bool shared;
+    bool is_static;
+    size_t pos; // of an insert or erase
+    size_t count; // elements inserted, appended or erased, or the new size
+                  // or capacity
+};
+
+/// Reports an operation on construction, unless it is made on behalf of
+/// another reported operation on the same thread. The operations made on
+/// its behalf are not reported until it is destroyed.
+template <bool TRACED>
+struct socow_trace_scope {
+    template <typename Report>
+    explicit socow_trace_scope(Report report);
+
+    // user-provided, so an unused scope is not warned about
+    ~socow_trace_scope();
+};
+
+template <>
+struct socow_trace_scope<true> {
+    template <typename Report>
+    explicit socow_trace_scope(Report report);
+
+    socow_trace_scope(socow_trace_scope const&) = delete;
+
+    socow_trace_scope& operator=(socow_trace_scope const&) = delete;
+
+    ~socow_trace_scope();
+
+private:
+    static size_t& depth();
+};
+
+/// Counters of the calling thread, summed over every vector whose policy
+/// has counted set.
+struct socow_stats {
+    size_t unshares = 0; // shared buffers replaced by a private copy
+    size_t unshared_elements = 0; // elements those copies copied
+    size_t reallocations = 0; // unique heap buffers moved to a new one
+    size_t reallocated_elements = 0; // elements those moves relocated
+    size_t to_dynamic = 0; // inline elements moved to the heap
+    size_t to_static = 0; // heap elements moved to inline storage
+};
+
+struct socow_counters {
+    static socow_stats stats();
+
+    static void reset_stats();
+
+private:
+    static socow_stats& local();
+
+    template <typename, size_t, typename, typename>
+    friend struct socow_vector;
+};
+
+/// Counters of the calling thread's pool.
+struct socow_pool_stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t retained_bytes = 0;
+};
+
+template <typename Policy>
+struct socow_block_pool {
+    static_assert((Policy::pool_max_block_bytes &
+                   (Policy::pool_max_block_bytes - 1)) == 0,
+                  "pool_max_block_bytes must be a power of two");
+
+    // rounds bytes up to its size class, bytes <= pool_max_block_bytes
+    static size_t round_size(size_t bytes);
+
+    static void* allocate(size_t bytes);
+
+    static void deallocate(void* ptr, size_t bytes);
+
+    static socow_pool_stats stats();
+
+    static void reset_stats();
+
+    // frees every block retained by the calling thread
+    static void trim();
+
+private:
+    static constexpr size_t MIN_CLASS = 6;
+    static constexpr size_t CLASSES = std::numeric_limits<size_t>::digits;
+
+    struct free_block {
+        free_block* next;
+    };
+
+    struct cache {
+        ~cache();
+
+        void clear();
+
+        std::array<free_block*, CLASSES> free_{};
+        socow_pool_stats stats_;
+    };
+
+    static size_t class_index(size_t bytes);
+
+    static cache* local();
+
+    // set once the thread's cache is destroyed, blocks freed afterwards by
+    // thread_local or static vectors go straight back to operator delete
+    static thread_local bool dead_;
+};
+
+/// Holds an allocator as an empty base when it is a stateless class, so that
+/// std::allocator takes no space in the vector or in its buffer header.
+template <typename Alloc,
+          bool = std::is_empty_v<Alloc> && !std::is_final_v<Alloc>>
+struct socow_allocator_holder : private Alloc {
+    explicit socow_allocator_holder(Alloc const& alloc);
+
+    Alloc& alloc();
+
+    Alloc const& alloc() const;
+};
+
+template <typename Alloc>
+struct socow_allocator_holder<Alloc, false> {
+    explicit socow_allocator_holder(Alloc const& alloc);
+
+    Alloc& alloc();
+
+    Alloc const& alloc() const;
+
+private:
+    Alloc alloc_;
+};
+
+/// Pointer and size of elements that may be written without further checks.
+template <typename T>
+struct socow_span {
+    socow_span(T* data, size_t size);
+
+    T* data() const;
+
+    size_t size() const;
+
+    bool empty() const;
+
+    T& operator[](size_t i) const;
+
+    T* begin() const;
+
+    T* end() const;
+
+private:
+    T* data_;
+    size_t size_;
+};
+
+/// Element of a socow_vector that is read from the buffer as it is, and
+/// unshares it only when assigned to.
+template <typename Vector>
+struct socow_lazy_reference {
+    using value_type = typename Vector::value_type;
+
+    socow_lazy_reference(Vector& vec, size_t index);
+
+    socow_lazy_reference(socow_lazy_reference const& other) = default;
+
+    operator value_type const&() const;
+
+    value_type const& get() const;
+
+    // unshares the buffer and returns a plain reference
+    value_type& get_mutable() const;
+
+    socow_lazy_reference& operator=(value_type const& value);
+
+    socow_lazy_reference& operator=(value_type&& value);
+
+    socow_lazy_reference& operator=(socow_lazy_reference const& other);
+
+private:
+    Vector* vec_;
+    size_t index_;
+};
+
+template <typename Vector>
+struct socow_lazy_iterator {
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = typename Vector::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference = socow_lazy_reference<Vector>;
+    using pointer = void;
+
+    socow_lazy_iterator();
+
+    socow_lazy_iterator(Vector& vec, size_t index);
+
+    reference operator*() const;
+
+    reference operator[](difference_type n) const;
+
+    socow_lazy_iterator& operator++();
+
+    socow_lazy_iterator operator++(int);
+
+    socow_lazy_iterator& operator--();
+
+    socow_lazy_iterator operator--(int);
+
+    socow_lazy_iterator& operator+=(difference_type n);
+
+    socow_lazy_iterator& operator-=(difference_type n);
+
+    socow_lazy_iterator operator+(difference_type n) const;
+
+    socow_lazy_iterator operator-(difference_type n) const;
+
+    difference_type operator-(socow_lazy_iterator const& other) const;
+
+    bool operator==(socow_lazy_iterator const& other) const;
+
+    bool operator!=(socow_lazy_iterator const& other) const;
+
+    bool operator<(socow_lazy_iterator const& other) const;
+
+    bool operator>(socow_lazy_iterator const& other) const;
+
+    bool operator<=(socow_lazy_iterator const& other) const;
+
+    bool operator>=(socow_lazy_iterator const& other) const;
+
+private:
+    Vector* vec_;
+    size_t index_;
+};
+
+template <typename Vector>
+struct socow_lazy_view {
+    using iterator = socow_lazy_iterator<Vector>;
+    using reference = socow_lazy_reference<Vector>;
+
+    explicit socow_lazy_view(Vector& vec);
+
+    iterator begin() const;
+
+    iterator end() const;
+
+    size_t size() const;
+
+    reference operator[](size_t i) const;
+
+private:
+    Vector* vec_;
+};
+
+template <typename T, size_t SMALL_SIZE,
+          typename Policy = socow_default_policy,
+          typename Allocator = std::allocator<T>>
+struct socow_vector : private socow_allocator_holder<Allocator> {
+    static_assert(std::is_same_v<typename Allocator::value_type, T>,
+                  "Allocator::value_type must be T");
 
-template <typename T, size_t SMALL_SIZE>
-struct socow_vector {
 private:
     struct static_storage;
     struct dynamic_storage;
 
+    template <typename It>
+    using require_input_iterator = std::enable_if_t<std::is_convertible_v<
+        typename std::iterator_traits<It>::iterator_category,
+        std::input_iterator_tag>>;
+
+    template <typename It>
+    static constexpr bool is_forward_iterator = std::is_base_of_v<
+        std::forward_iterator_tag,
+        typename std::iterator_traits<It>::iterator_category>;
+
 public:
+    using value_type = T;
     using iterator = T*;
     using const_iterator = T const*;
+    using allocator_type = Allocator;
 
     socow_vector();
 
+    explicit socow_vector(Allocator const& alloc);
+
+    socow_vector(size_t cnt, T const& value,
+                 Allocator const& alloc = Allocator());
+
+    template <typename InputIt, typename = require_input_iterator<InputIt>>
+    socow_vector(InputIt first, InputIt last,
+                 Allocator const& alloc = Allocator());
+
+    socow_vector(std::initializer_list<T> init,
+                 Allocator const& alloc = Allocator());
+
     socow_vector(socow_vector const& other);
 
+    socow_vector(socow_vector&& other) noexcept(
+        std::is_nothrow_move_constructible_v<T>);
+
+    // takes over the buffer of other if alloc is equal to its allocator,
+    // moves the elements one by one otherwise
+    socow_vector(socow_vector&& other, Allocator const& alloc) noexcept(
+        std::is_nothrow_move_constructible_v<T> &&
+        alloc_traits::is_always_equal::value);
+
     socow_vector& operator=(socow_vector const& other);
 
+    socow_vector& operator=(socow_vector&& other) noexcept(
+        std::is_nothrow_move_constructible_v<T> &&
+        (alloc_traits::propagate_on_container_move_assignment::value ||
+         alloc_traits::is_always_equal::value));
+
+    socow_vector& operator=(std::initializer_list<T> init);
+
+    void assign(size_t cnt, T const& value);
+
+    template <typename InputIt, typename = require_input_iterator<InputIt>>
+    void assign(InputIt first, InputIt last);
+
+    void assign(std::initializer_list<T> init);
+
     ~socow_vector();
 
+    Allocator get_allocator() const;
+
     T& operator[](size_t i);
 
     T const& operator[](size_t i) const;
@@ -30,6 +823,16 @@ public:
 
     T const* data() const;
 
+    // unshares once, the result stays writable without further copy checks
+    // until the size or capacity changes or the vector is copied from
+    T* unique_data();
+
+    socow_span<T> mutable_span();
+
+    // a view whose references read the buffer even while it is shared and
+    // unshare it only when they are assigned through
+    socow_lazy_view<socow_vector> lazy();
+
     size_t size() const;
 
     T& front();
@@ -42,14 +845,33 @@ public:
 
     void push_back(T const& value);
 
+    void push_back(T&& value);
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args);
+
     void pop_back();
 
+    template <typename InputIt, typename = require_input_iterator<InputIt>>
+    void append(InputIt first, InputIt last);
+
+    void append(std::initializer_list<T> init);
+
     bool empty() const;
 
     size_t capacity() const;
 
+    // number of vectors sharing the buffer, 1 for inline elements
+    size_t ref_count() const;
+
     void reserve(size_t new_cap);
 
+    void resize(size_t new_size);
+
+    void resize(size_t new_size, T const& value);
+
+    void resize_default_init(size_t new_size);
+
     void shrink_to_fit();
 
     void clear();
@@ -66,11 +888,39 @@ public:
 
     iterator insert(const_iterator pos, T const& value);
 
+    iterator insert(const_iterator pos, T&& value);
+
+    iterator insert(const_iterator pos, size_t cnt, T const& value);
+
+    template <typename InputIt, typename = require_input_iterator<InputIt>>
+    iterator insert(const_iterator pos, InputIt first, InputIt last);
+
+    iterator insert(const_iterator pos, std::initializer_list<T> init);
+
+    template <typename... Args>
+    iterator emplace(const_iterator pos, Args&&... args);
+
     iterator erase(const_iterator pos);
 
     iterator erase(const_iterator first, const_iterator last);
 
+    template <typename Pred>
+    size_t erase_if(Pred pred);
+
+    // writes the elements to fd as described by socow_file_header, T must
+    // be trivially copyable
+    void save(int fd) const;
+
+    // reads what save wrote from the current position of fd, mapping the
+    // file instead if the policy has mapped_files set. Pages of a mapping
+    // not yet copied show what others write to the file later, so it must
+    // not change while the vector or a copy of it may read it
+    static socow_vector load(int fd, Allocator const& alloc = Allocator());
+
 private:
+    using alloc_traits = std::allocator_traits<Allocator>;
+    using trace_scope = socow_trace_scope<Policy::traced>;
+
     size_t size_{1};
     union {
         static_storage stat_buf_;
@@ -87,9 +937,57 @@ private:
 
     static void destruct_storage(dynamic_storage& buf, size_t buf_size);
 
-    void copy_storage();
+    static void copy_elements(T const* src, T* dst, size_t cnt);
+
+    static void move_elements(T* src, T* dst, size_t cnt);
+
+    static void relocate_elements(T* src, T* dst, size_t cnt);
+
+    static void destroy_elements(T* elems, size_t cnt);
+
+    template <typename ForwardIt>
+    static void construct_elements(ForwardIt first, T* dst, size_t cnt);
+
+    static void fill_elements(T const& value, T* dst, size_t cnt);
+
+    template <bool VALUE_INIT>
+    static void init_elements(T* dst, size_t cnt);
 
-    T& get_elem(size_t i);
+    size_t unshare_capacity(size_t new_size) const;
+
+    void copy_storage(size_t min_cap = 0);
+
+    void truncate(size_t new_size);
+
+    template <bool VALUE_INIT>
+    void resize_init(size_t new_size);
+
+    void make_room(size_t cnt = 1);
+
+    template <typename InputIt>
+    void construct_back(InputIt first, InputIt last);
+
+    template <typename Construct>
+    iterator insert_constructed(size_t pos_index, size_t cnt,
+                                Construct construct);
+
+    bool is_shared() const;
+
+    trace_scope trace(socow_op op, size_t pos = 0, size_t cnt = 0,
+                      socow_vector const* other = nullptr) const;
+
+    static void count(size_t socow_stats::*counter, size_t n = 1);
+
+    // builds this vector's storage from the elements of other's dynamic
+    // buffer, leaving the buffer to other
+    void take_elements(socow_vector& other);
+
+    template <typename Construct>
+    void unshare_around(size_t pos_index, size_t erase_cnt, size_t cnt,
+                        Construct construct);
+
+    template <typename Pred>
+    void erase_if_shared(size_t first_index, Pred& pred);
 
     iterator get_begin();
 
@@ -98,10 +996,12 @@ private:
     static void swap_stat_dyn(socow_vector& stat_vec, socow_vector& dyn_vec);
 
     void rebuild_storage(size_t new_cap);
+
+    void rebuild_storage(size_t new_cap, size_t new_size);
 };
 
-template <typename T, size_t SMALL_SIZE>
-struct socow_vector<T, SMALL_SIZE>::static_storage {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+struct socow_vector<T, SMALL_SIZE, Policy, Allocator>::static_storage {
     static_storage();
 
     static_storage(static_storage const& other, size_t stor_size);
@@ -116,458 +1016,2097 @@ private:
     std::array<std::aligned_storage_t<sizeof(T), alignof(T)>, SMALL_SIZE> data_;
 };
 
-template <typename T, size_t SMALL_SIZE>
-struct socow_vector<T, SMALL_SIZE>::dynamic_storage {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+struct socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage {
 private:
     struct metadata;
 
 public:
-    explicit dynamic_storage(size_t cap);
+    dynamic_storage(size_t cap, Allocator const& alloc);
 
     dynamic_storage(dynamic_storage const& other);
 
-    size_t capacity() const;
+    dynamic_storage(dynamic_storage&& other) noexcept;
 
-    size_t& ref_count();
+    // private mapping of the first cap elements of other's memfd, only if
+    // other.can_map_copy(cap), all_data_ is nullptr if mapping fails
+    dynamic_storage(dynamic_storage const& other, size_t cap);
 
-    T* data();
+    // read-only mapping of the cnt elements at pos + data_offset in the
+    // regular file fd, pos at a page boundary, only if mapped
+    dynamic_storage(int fd, size_t pos, size_t data_offset, size_t cnt,
+                    Allocator const& alloc);
 
-    T const* data() const;
+    size_t capacity() const;
+
+    bool can_map_copy(size_t cap) const;
+
+    // called before a unique buffer is written to, false if it has to be
+    // copied first
+    bool prepare_write();
+
+    bool unique() const;
+
+    size_t ref_count() const;
+
+    void retain();
+
+    bool release();
+
+    T* data();
+
+    T const* data() const;
 
     void swap(dynamic_storage& other);
 
     void clear(size_t stor_size);
 
+    void deallocate();
+
 private:
-    metadata* all_data_;
+    // the header and the elements are allocated as one array of blocks
+    static constexpr size_t block_align =
+        std::max(alignof(T), alignof(std::max_align_t));
+    using block = std::aligned_storage_t<block_align, block_align>;
+    using block_allocator = typename alloc_traits::template rebind_alloc<block>;
+    using block_traits = std::allocator_traits<block_allocator>;
+
+    static size_t block_count(size_t cap);
+
+    // pages of a file can only be copied lazily if nobody has to run code
+    // to copy or destroy the elements
+    static constexpr bool mapped =
+        (Policy::memfd_threshold != 0 || Policy::mapped_files) &&
+        std::is_trivially_copyable_v<T> &&
+        std::is_same_v<Allocator, std::allocator<T>>;
+
+    static size_t mapping_length(size_t cap);
+
+    // the pool hands out blocks from plain operator new, which is what
+    // std::allocator would use for them anyway
+    static constexpr bool pooled =
+        Policy::pooled && std::is_same_v<Allocator, std::allocator<T>> &&
+        block_align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    // only malloc can tell how big the block it returned really is
+    static constexpr bool malloced =
+        Policy::round_to_usable_size &&
+        std::is_same_v<Allocator, std::allocator<T>> &&
+        block_align <= alignof(std::max_align_t);
 
-    static constexpr std::align_val_t meta_al =
-        static_cast<std::align_val_t>(alignof(metadata));
+    metadata* all_data_;
 
     friend struct socow_vector;
 };
 
-template <typename T, size_t SMALL_SIZE>
-struct socow_vector<T, SMALL_SIZE>::dynamic_storage::metadata {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+struct socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::metadata
+    : socow_allocator_holder<block_allocator>,
+      socow_mapping<dynamic_storage::mapped> {
+    metadata(size_t cap, block_allocator const& alloc);
+
 private:
     size_t capacity_;
-    size_t ref_count_;
+    socow_ref_count<Policy::thread_safe> ref_count_;
     T data_[];
 
     friend struct socow_vector::dynamic_storage;
 };
 
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+struct is_trivially_relocatable<socow_vector<T, SMALL_SIZE, Policy, Allocator>>
+    : std::conjunction<is_trivially_relocatable<T>,
+                       is_trivially_relocatable<Allocator>> {};
+
+#if __has_include(<memory_resource>)
+template <typename T, size_t SMALL_SIZE, typename Policy = socow_default_policy>
+using pmr_socow_vector =
+    socow_vector<T, SMALL_SIZE, Policy, std::pmr::polymorphic_allocator<T>>;
+#endif
+
+/// TRACE SCOPE
+template <bool TRACED>
+template <typename Report>
+socow_trace_scope<TRACED>::socow_trace_scope(Report) {}
+
+template <bool TRACED>
+socow_trace_scope<TRACED>::~socow_trace_scope() {}
+
+template <typename Report>
+socow_trace_scope<true>::socow_trace_scope(Report report) {
+    if (depth() == 0) {
+        report();
+    }
+    ++depth();
+}
+
+inline socow_trace_scope<true>::~socow_trace_scope() {
+    --depth();
+}
+
+inline size_t& socow_trace_scope<true>::depth() {
+    thread_local size_t value = 0;
+    return value;
+}
+
+/// COUNTERS
+inline socow_stats socow_counters::stats() {
+    return local();
+}
+
+inline void socow_counters::reset_stats() {
+    local() = socow_stats();
+}
+
+inline socow_stats& socow_counters::local() {
+    thread_local socow_stats value;
+    return value;
+}
+
+/// REFERENCE COUNT
+template <bool THREAD_SAFE>
+socow_ref_count<THREAD_SAFE>::socow_ref_count() : count_(1) {}
+
+template <bool THREAD_SAFE>
+bool socow_ref_count<THREAD_SAFE>::unique() const {
+    if constexpr (THREAD_SAFE) {
+        // pairs with the release in release(), so the last owner sees every
+        // access made through the copies that have let go of the buffer
+        return count_.load(std::memory_order_acquire) == 1;
+    } else {
+        return count_ == 1;
+    }
+}
+
+template <bool THREAD_SAFE>
+size_t socow_ref_count<THREAD_SAFE>::count() const {
+    if constexpr (THREAD_SAFE) {
+        return count_.load(std::memory_order_relaxed);
+    } else {
+        return count_;
+    }
+}
+
+template <bool THREAD_SAFE>
+void socow_ref_count<THREAD_SAFE>::retain() {
+    if constexpr (THREAD_SAFE) {
+        count_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        ++count_;
+    }
+}
+
+template <bool THREAD_SAFE>
+bool socow_ref_count<THREAD_SAFE>::release() {
+    if (unique()) {
+        // nobody else can reach the buffer to take a new reference
+        return true;
+    }
+    if constexpr (THREAD_SAFE) {
+        if (count_.fetch_sub(1, std::memory_order_release) == 1) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return true;
+        }
+        return false;
+    } else {
+        return --count_ == 0;
+    }
+}
+
+/// BLOCK POOL
+template <typename Policy>
+thread_local bool socow_block_pool<Policy>::dead_ = false;
+
+template <typename Policy>
+size_t socow_block_pool<Policy>::round_size(size_t bytes) {
+    return size_t(1) << class_index(bytes);
+}
+
+template <typename Policy>
+void* socow_block_pool<Policy>::allocate(size_t bytes) {
+    cache* c = local();
+    if (c != nullptr) {
+        free_block*& head = c->free_[class_index(bytes)];
+        if (head != nullptr) {
+            free_block* block = head;
+            head = block->next;
+            c->stats_.retained_bytes -= bytes;
+            ++c->stats_.hits;
+            return block;
+        }
+        ++c->stats_.misses;
+    }
+    return ::operator new(bytes);
+}
+
+template <typename Policy>
+void socow_block_pool<Policy>::deallocate(void* ptr, size_t bytes) {
+    cache* c = local();
+    if (c == nullptr ||
+        c->stats_.retained_bytes + bytes > Policy::pool_max_bytes) {
+        ::operator delete(ptr);
+        return;
+    }
+    free_block*& head = c->free_[class_index(bytes)];
+    head = new (ptr) free_block{head};
+    c->stats_.retained_bytes += bytes;
+}
+
+template <typename Policy>
+socow_pool_stats socow_block_pool<Policy>::stats() {
+    cache* c = local();
+    return c != nullptr ? c->stats_ : socow_pool_stats();
+}
+
+template <typename Policy>
+void socow_block_pool<Policy>::reset_stats() {
+    cache* c = local();
+    if (c != nullptr) {
+        c->stats_.hits = 0;
+        c->stats_.misses = 0;
+    }
+}
+
+template <typename Policy>
+void socow_block_pool<Policy>::trim() {
+    cache* c = local();
+    if (c != nullptr) {
+        c->clear();
+    }
+}
+
+template <typename Policy>
+size_t socow_block_pool<Policy>::class_index(size_t bytes) {
+    size_t index = MIN_CLASS;
+    while ((size_t(1) << index) < bytes) {
+        ++index;
+    }
+    return index;
+}
+
+template <typename Policy>
+typename socow_block_pool<Policy>::cache* socow_block_pool<Policy>::local() {
+    if (dead_) {
+        return nullptr;
+    }
+    static thread_local cache c;
+    return &c;
+}
+
+template <typename Policy>
+socow_block_pool<Policy>::cache::~cache() {
+    clear();
+    dead_ = true;
+}
+
+template <typename Policy>
+void socow_block_pool<Policy>::cache::clear() {
+    for (free_block*& head : free_) {
+        while (head != nullptr) {
+            free_block* next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+    }
+    stats_.retained_bytes = 0;
+}
+
+/// ALLOCATOR HOLDER
+template <typename Alloc, bool EMPTY>
+socow_allocator_holder<Alloc, EMPTY>::socow_allocator_holder(
+    Alloc const& alloc)
+    : Alloc(alloc) {}
+
+template <typename Alloc, bool EMPTY>
+Alloc& socow_allocator_holder<Alloc, EMPTY>::alloc() {
+    return *this;
+}
+
+template <typename Alloc, bool EMPTY>
+Alloc const& socow_allocator_holder<Alloc, EMPTY>::alloc() const {
+    return *this;
+}
+
+template <typename Alloc>
+socow_allocator_holder<Alloc, false>::socow_allocator_holder(
+    Alloc const& alloc)
+    : alloc_(alloc) {}
+
+template <typename Alloc>
+Alloc& socow_allocator_holder<Alloc, false>::alloc() {
+    return alloc_;
+}
+
+template <typename Alloc>
+Alloc const& socow_allocator_holder<Alloc, false>::alloc() const {
+    return alloc_;
+}
+
+/// SPAN
+template <typename T>
+socow_span<T>::socow_span(T* data, size_t size) : data_(data), size_(size) {}
+
+template <typename T>
+T* socow_span<T>::data() const {
+    return data_;
+}
+
+template <typename T>
+size_t socow_span<T>::size() const {
+    return size_;
+}
+
+template <typename T>
+bool socow_span<T>::empty() const {
+    return size_ == 0;
+}
+
+template <typename T>
+T& socow_span<T>::operator[](size_t i) const {
+    return data_[i];
+}
+
+template <typename T>
+T* socow_span<T>::begin() const {
+    return data_;
+}
+
+template <typename T>
+T* socow_span<T>::end() const {
+    return data_ + size_;
+}
+
+/// LAZY VIEW
+template <typename Vector>
+socow_lazy_reference<Vector>::socow_lazy_reference(Vector& vec, size_t index)
+    : vec_(&vec), index_(index) {}
+
+template <typename Vector>
+socow_lazy_reference<Vector>::operator value_type const&() const {
+    return get();
+}
+
+template <typename Vector>
+typename socow_lazy_reference<Vector>::value_type const&
+socow_lazy_reference<Vector>::get() const {
+    return static_cast<Vector const&>(*vec_)[index_];
+}
+
+template <typename Vector>
+typename socow_lazy_reference<Vector>::value_type&
+socow_lazy_reference<Vector>::get_mutable() const {
+    return (*vec_)[index_];
+}
+
+template <typename Vector>
+socow_lazy_reference<Vector>&
+socow_lazy_reference<Vector>::operator=(value_type const& value) {
+    Vector const& vec = *vec_;
+    if (&value >= vec.data() && &value < vec.data() + vec.size()) {
+        // the unshare may free the buffer value lives in
+        value_type tmp(value);
+        get_mutable() = std::move(tmp);
+    } else {
+        get_mutable() = value;
+    }
+    return *this;
+}
+
+template <typename Vector>
+socow_lazy_reference<Vector>&
+socow_lazy_reference<Vector>::operator=(value_type&& value) {
+    get_mutable() = std::move(value);
+    return *this;
+}
+
+template <typename Vector>
+socow_lazy_reference<Vector>&
+socow_lazy_reference<Vector>::operator=(socow_lazy_reference const& other) {
+    return *this = other.get();
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector>::socow_lazy_iterator()
+    : vec_(nullptr), index_(0) {}
+
+template <typename Vector>
+socow_lazy_iterator<Vector>::socow_lazy_iterator(Vector& vec, size_t index)
+    : vec_(&vec), index_(index) {}
+
+template <typename Vector>
+typename socow_lazy_iterator<Vector>::reference
+socow_lazy_iterator<Vector>::operator*() const {
+    return reference(*vec_, index_);
+}
+
+template <typename Vector>
+typename socow_lazy_iterator<Vector>::reference
+socow_lazy_iterator<Vector>::operator[](difference_type n) const {
+    return reference(*vec_, index_ + n);
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector>& socow_lazy_iterator<Vector>::operator++() {
+    ++index_;
+    return *this;
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector> socow_lazy_iterator<Vector>::operator++(int) {
+    socow_lazy_iterator old = *this;
+    ++index_;
+    return old;
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector>& socow_lazy_iterator<Vector>::operator--() {
+    --index_;
+    return *this;
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector> socow_lazy_iterator<Vector>::operator--(int) {
+    socow_lazy_iterator old = *this;
+    --index_;
+    return old;
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector>&
+socow_lazy_iterator<Vector>::operator+=(difference_type n) {
+    index_ += n;
+    return *this;
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector>&
+socow_lazy_iterator<Vector>::operator-=(difference_type n) {
+    index_ -= n;
+    return *this;
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector>
+socow_lazy_iterator<Vector>::operator+(difference_type n) const {
+    return socow_lazy_iterator(*this) += n;
+}
+
+template <typename Vector>
+socow_lazy_iterator<Vector>
+socow_lazy_iterator<Vector>::operator-(difference_type n) const {
+    return socow_lazy_iterator(*this) -= n;
+}
+
+template <typename Vector>
+typename socow_lazy_iterator<Vector>::difference_type
+socow_lazy_iterator<Vector>::operator-(socow_lazy_iterator const& other) const {
+    return static_cast<difference_type>(index_ - other.index_);
+}
+
+template <typename Vector>
+bool socow_lazy_iterator<Vector>::operator==(
+    socow_lazy_iterator const& other) const {
+    return index_ == other.index_;
+}
+
+template <typename Vector>
+bool socow_lazy_iterator<Vector>::operator!=(
+    socow_lazy_iterator const& other) const {
+    return index_ != other.index_;
+}
+
+template <typename Vector>
+bool socow_lazy_iterator<Vector>::operator<(
+    socow_lazy_iterator const& other) const {
+    return index_ < other.index_;
+}
+
+template <typename Vector>
+bool socow_lazy_iterator<Vector>::operator>(
+    socow_lazy_iterator const& other) const {
+    return index_ > other.index_;
+}
+
+template <typename Vector>
+bool socow_lazy_iterator<Vector>::operator<=(
+    socow_lazy_iterator const& other) const {
+    return index_ <= other.index_;
+}
+
+template <typename Vector>
+bool socow_lazy_iterator<Vector>::operator>=(
+    socow_lazy_iterator const& other) const {
+    return index_ >= other.index_;
+}
+
+template <typename Vector>
+socow_lazy_view<Vector>::socow_lazy_view(Vector& vec) : vec_(&vec) {}
+
+template <typename Vector>
+typename socow_lazy_view<Vector>::iterator
+socow_lazy_view<Vector>::begin() const {
+    return iterator(*vec_, 0);
+}
+
+template <typename Vector>
+typename socow_lazy_view<Vector>::iterator
+socow_lazy_view<Vector>::end() const {
+    return iterator(*vec_, vec_->size());
+}
+
+template <typename Vector>
+size_t socow_lazy_view<Vector>::size() const {
+    return vec_->size();
+}
+
+template <typename Vector>
+typename socow_lazy_view<Vector>::reference
+socow_lazy_view<Vector>::operator[](size_t i) const {
+    return reference(*vec_, i);
+}
+
 /// SOCOW VECTOR
-template <typename T, size_t SMALL_SIZE>
-socow_vector<T, SMALL_SIZE>::socow_vector() : stat_buf_() {}
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::socow_vector()
+    : socow_vector(Allocator()) {}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::socow_vector(
+    Allocator const& alloc)
+    : socow_allocator_holder<Allocator>(alloc), stat_buf_() {
+    trace(socow_op::create);
+}
 
-template <typename T, size_t SMALL_SIZE>
-socow_vector<T, SMALL_SIZE>::socow_vector(socow_vector const& other)
-    : size_(other.size_) {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::socow_vector(
+    size_t cnt, T const& value, Allocator const& alloc)
+    : socow_vector(alloc) {
+    auto scope = trace(socow_op::append, 0, cnt);
+    reserve(cnt);
+    fill_elements(value, get_begin(), cnt);
+    size_ += cnt << 1;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename InputIt, typename>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::socow_vector(
+    InputIt first, InputIt last, Allocator const& alloc)
+    : socow_vector(alloc) {
+    construct_back(first, last);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::socow_vector(
+    std::initializer_list<T> init, Allocator const& alloc)
+    : socow_vector(init.begin(), init.end(), alloc) {}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::socow_vector(
+    socow_vector const& other)
+    : socow_allocator_holder<Allocator>(
+          alloc_traits::select_on_container_copy_construction(other.alloc())),
+      size_(other.size_) {
     if (other.is_static()) {
         new (&stat_buf_) static_storage(other.stat_buf_, other.size());
     } else {
         new (&dyn_buf_) dynamic_storage(other.dyn_buf_);
     }
+    trace(socow_op::copy, 0, 0, &other);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::socow_vector(
+    socow_vector&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+    : socow_vector(std::move(other), other.alloc()) {}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::socow_vector(
+    socow_vector&& other, Allocator const& alloc) noexcept(
+    std::is_nothrow_move_constructible_v<T> &&
+    alloc_traits::is_always_equal::value)
+    : socow_allocator_holder<Allocator>(alloc), size_(other.size_) {
+    if (other.is_static()) {
+        new (&stat_buf_) static_storage();
+        relocate_elements(other.stat_buf_.data(), stat_buf_.data(),
+                          other.size());
+    } else if (alloc_traits::is_always_equal::value ||
+               this->alloc() == other.alloc()) {
+        new (&dyn_buf_) dynamic_storage(std::move(other.dyn_buf_));
+        other.dyn_buf_.~dynamic_storage();
+        new (&other.stat_buf_) static_storage();
+    } else {
+        // the buffer belongs to the memory of other's allocator, which may
+        // go away before this vector does
+        take_elements(other);
+        destruct_storage(other.dyn_buf_, other.size());
+        new (&other.stat_buf_) static_storage();
+    }
+    other.size_ = 1;
+    trace(socow_op::move, 0, 0, &other);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>&
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::operator=(
+    socow_vector const& other) {
+    auto scope = trace(socow_op::assign, 0, 0, &other);
+    socow_vector(other).swap(*this);
+    if constexpr (alloc_traits::propagate_on_container_copy_assignment::value) {
+        this->alloc() = other.alloc();
+    }
+    return *this;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>&
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::operator=(
+    socow_vector&& other) noexcept(
+    std::is_nothrow_move_constructible_v<T> &&
+    (alloc_traits::propagate_on_container_move_assignment::value ||
+     alloc_traits::is_always_equal::value)) {
+    auto scope = trace(socow_op::move_assign, 0, 0, &other);
+    if (this != &other) {
+        if constexpr (!std::is_nothrow_move_constructible_v<T>) {
+            if (other.is_static()) {
+                // moving inline elements may throw, keep the copy-and-swap
+                // guarantees instead of leaving *this half-built
+                return *this = other;
+            }
+        }
+        if constexpr (!alloc_traits::propagate_on_container_move_assignment::
+                          value &&
+                      !alloc_traits::is_always_equal::value) {
+            if (this->alloc() != other.alloc()) {
+                // the elements are moved into memory from this->alloc()
+                // before the old ones are let go
+                socow_vector(std::move(other), this->alloc()).swap(*this);
+                return *this;
+            }
+        }
+        Allocator alloc =
+            alloc_traits::propagate_on_container_move_assignment::value
+                ? other.alloc()
+                : this->alloc();
+        this->~socow_vector();
+        new (this) socow_vector(std::move(other), alloc);
+    }
+    return *this;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>&
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::operator=(
+    std::initializer_list<T> init) {
+    assign(init);
+    return *this;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::assign(size_t cnt,
+                                                            T const& value) {
+    auto scope = trace(socow_op::assign, 0, cnt);
+    if (&value >= get_begin() && &value < get_end()) {
+        T tmp(value);
+        assign(cnt, tmp);
+        return;
+    }
+    clear();
+    reserve(cnt);
+    fill_elements(value, get_begin(), cnt);
+    size_ += cnt << 1;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename InputIt, typename>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::assign(InputIt first,
+                                                            InputIt last) {
+    clear();
+    construct_back(first, last);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::assign(
+    std::initializer_list<T> init) {
+    assign(init.begin(), init.end());
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::~socow_vector() {
+    trace(socow_op::destroy);
+    if (is_static()) {
+        destruct_storage(stat_buf_, size());
+    } else {
+        destruct_storage(dyn_buf_, size());
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+Allocator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::get_allocator() const {
+    return this->alloc();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T& socow_vector<T, SMALL_SIZE, Policy, Allocator>::operator[](size_t i) {
+    return data()[i];
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T const& socow_vector<T, SMALL_SIZE, Policy, Allocator>::operator[](
+    size_t i) const {
+    return data()[i];
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T* socow_vector<T, SMALL_SIZE, Policy, Allocator>::data() {
+    trace(socow_op::write);
+    copy_storage();
+    return is_static() ? stat_buf_.data() : dyn_buf_.data();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T const* socow_vector<T, SMALL_SIZE, Policy, Allocator>::data() const {
+    return is_static() ? stat_buf_.data() : dyn_buf_.data();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T* socow_vector<T, SMALL_SIZE, Policy, Allocator>::unique_data() {
+    return data();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_span<T> socow_vector<T, SMALL_SIZE, Policy, Allocator>::mutable_span() {
+    return socow_span<T>(data(), size());
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_lazy_view<socow_vector<T, SMALL_SIZE, Policy, Allocator>>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::lazy() {
+    return socow_lazy_view<socow_vector>(*this);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+size_t socow_vector<T, SMALL_SIZE, Policy, Allocator>::size() const {
+    return size_ >> 1;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T& socow_vector<T, SMALL_SIZE, Policy, Allocator>::front() {
+    return *begin();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T const& socow_vector<T, SMALL_SIZE, Policy, Allocator>::front() const {
+    return *begin();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T& socow_vector<T, SMALL_SIZE, Policy, Allocator>::back() {
+    return *(end() - 1);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T const& socow_vector<T, SMALL_SIZE, Policy, Allocator>::back() const {
+    return *(end() - 1);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::push_back(T const& value) {
+    auto scope = trace(socow_op::append, size(), 1);
+    size_t val_pos = &value >= get_begin() ? &value - get_begin()
+                                           : std::numeric_limits<size_t>::max();
+    size_t cur_size = size();
+    make_room();
+    T* cur_data = get_begin();
+    new (cur_data + cur_size) T(val_pos < cur_size ? cur_data[val_pos] : value);
+    size_ += 2;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::push_back(T&& value) {
+    auto scope = trace(socow_op::append, size(), 1);
+    size_t val_pos = &value >= get_begin() ? &value - get_begin()
+                                           : std::numeric_limits<size_t>::max();
+    size_t cur_size = size();
+    make_room();
+    T* cur_data = get_begin();
+    new (cur_data + cur_size)
+        T(std::move(val_pos < cur_size ? cur_data[val_pos] : value));
+    size_ += 2;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename... Args>
+T& socow_vector<T, SMALL_SIZE, Policy, Allocator>::emplace_back(
+    Args&&... args) {
+    auto scope = trace(socow_op::append, size(), 1);
+    size_t cur_size = size();
+    if (cur_size == capacity()) {
+        // args may refer to elements that rebuild_storage is about to destroy
+        if constexpr (is_trivially_relocatable_v<T>) {
+            std::aligned_storage_t<sizeof(T), alignof(T)> tmp;
+            new (&tmp) T(std::forward<Args>(args)...);
+            try {
+                make_room();
+            } catch (...) {
+                reinterpret_cast<T*>(&tmp)->~T();
+                throw;
+            }
+            std::memcpy(static_cast<void*>(get_begin() + cur_size), &tmp,
+                        sizeof(T));
+        } else {
+            T tmp(std::forward<Args>(args)...);
+            make_room();
+            new (get_begin() + cur_size) T(std::move(tmp));
+        }
+    } else {
+        // a shared buffer outlives the unshare, so args stay valid
+        make_room();
+        new (get_begin() + cur_size) T(std::forward<Args>(args)...);
+    }
+    size_ += 2;
+    return get_begin()[cur_size];
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::pop_back() {
+    auto scope = trace(socow_op::pop);
+    truncate(size() - 1);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename InputIt, typename>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::append(InputIt first,
+                                                            InputIt last) {
+    if constexpr (is_forward_iterator<InputIt>) {
+        make_room(std::distance(first, last));
+    }
+    construct_back(first, last);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::append(
+    std::initializer_list<T> init) {
+    append(init.begin(), init.end());
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+bool socow_vector<T, SMALL_SIZE, Policy, Allocator>::empty() const {
+    return size() == 0;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+size_t socow_vector<T, SMALL_SIZE, Policy, Allocator>::capacity() const {
+    return is_static() ? SMALL_SIZE : dyn_buf_.capacity();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+size_t socow_vector<T, SMALL_SIZE, Policy, Allocator>::ref_count() const {
+    return is_static() ? 1 : dyn_buf_.ref_count();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::reserve(size_t new_cap) {
+    auto scope = trace(socow_op::reserve, 0, new_cap);
+    if (capacity() < new_cap) {
+        rebuild_storage(new_cap);
+    } else {
+        copy_storage(new_cap);
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::resize(size_t new_size) {
+    auto scope = trace(socow_op::resize, 0, new_size);
+    resize_init<true>(new_size);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::resize(size_t new_size,
+                                                            T const& value) {
+    auto scope = trace(socow_op::resize, 0, new_size);
+    size_t cur_size = size();
+    if (new_size <= cur_size) {
+        truncate(new_size);
+    } else if (&value >= get_begin() && &value < get_end()) {
+        T tmp(value);
+        resize(new_size, tmp);
+    } else {
+        make_room(new_size - cur_size);
+        fill_elements(value, get_end(), new_size - cur_size);
+        size_ += (new_size - cur_size) << 1;
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::resize_default_init(
+    size_t new_size) {
+    auto scope = trace(socow_op::resize, 0, new_size);
+    resize_init<false>(new_size);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::shrink_to_fit() {
+    auto scope = trace(socow_op::shrink);
+    if (size() != capacity()) {
+        rebuild_storage(size());
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::clear() {
+    auto scope = trace(socow_op::clear);
+    if (is_shared()) {
+        // just let go of the buffer, leaving it to the other owners
+        destruct_storage(dyn_buf_, size());
+        new (&stat_buf_) static_storage();
+        size_ = 1;
+    } else {
+        is_static() ? stat_buf_.clear(size()) : dyn_buf_.clear(size());
+        size_ = size_ % 2;
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::swap(socow_vector& other) {
+    auto scope = trace(socow_op::swap, 0, 0, &other);
+    if (is_static() && other.is_static()) {
+        size_t cur_size = size(), other_size = other.size();
+        if constexpr (is_trivially_relocatable_v<T> ||
+                      std::is_nothrow_move_constructible_v<T>) {
+            static_storage tmp;
+            relocate_elements(stat_buf_.data(), tmp.data(), cur_size);
+            relocate_elements(other.stat_buf_.data(), stat_buf_.data(),
+                              other_size);
+            relocate_elements(tmp.data(), other.stat_buf_.data(), cur_size);
+        } else {
+            // copies can fail half way, leaving the vectors valid but changed
+            static_storage tmp(stat_buf_, cur_size);
+            destruct_storage(stat_buf_, cur_size);
+            try {
+                new (&stat_buf_) static_storage(other.stat_buf_, other_size);
+            } catch (...) {
+                new (&stat_buf_) static_storage();
+                size_ = 1;
+                tmp.clear(cur_size);
+                throw;
+            }
+            destruct_storage(other.stat_buf_, other_size);
+            try {
+                new (&other.stat_buf_) static_storage(tmp, cur_size);
+            } catch (...) {
+                new (&other.stat_buf_) static_storage();
+                size_ = other.size_;
+                other.size_ = 1;
+                tmp.clear(cur_size);
+                throw;
+            }
+            tmp.clear(cur_size);
+        }
+    } else if (is_static() && !other.is_static()) {
+        swap_stat_dyn(*this, other);
+    } else if (other.is_static()) {
+        swap_stat_dyn(other, *this);
+    } else {
+        dyn_buf_.swap(other.dyn_buf_);
+    }
+    std::swap(size_, other.size_);
+    if constexpr (alloc_traits::propagate_on_container_swap::value) {
+        std::swap(this->alloc(), other.alloc());
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::begin() {
+    return data();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::end() {
+    return begin() + size();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::const_iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::begin() const {
+    return data();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::const_iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::end() const {
+    return begin() + size();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::insert(const_iterator pos,
+                                                       T const& value) {
+    return emplace(pos, value);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::insert(const_iterator pos,
+                                                       T&& value) {
+    return emplace(pos, std::move(value));
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::insert(const_iterator pos,
+                                                       size_t cnt,
+                                                       T const& value) {
+    size_t pos_index = pos - get_begin();
+    auto scope = trace(socow_op::insert, pos_index, cnt);
+    if (&value >= get_begin() && &value < get_end()) {
+        // value would be moved or freed while the gap is being made
+        T tmp(value);
+        return insert(get_begin() + pos_index, cnt, tmp);
+    }
+    return insert_constructed(pos_index, cnt, [&](T* dst) {
+        fill_elements(value, dst, cnt);
+    });
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename InputIt, typename>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::insert(const_iterator pos,
+                                                       InputIt first,
+                                                       InputIt last) {
+    size_t pos_index = pos - get_begin();
+    if constexpr (is_forward_iterator<InputIt>) {
+        size_t cnt = std::distance(first, last);
+        auto scope = trace(socow_op::insert, pos_index, cnt);
+        return insert_constructed(pos_index, cnt, [&](T* dst) {
+            construct_elements(first, dst, cnt);
+        });
+    } else {
+        size_t old_size = size();
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+        T* cur_data = get_begin();
+        std::rotate(cur_data + pos_index, cur_data + old_size,
+                    cur_data + size());
+        return cur_data + pos_index;
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::insert(
+    const_iterator pos, std::initializer_list<T> init) {
+    return insert(pos, init.begin(), init.end());
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename... Args>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::emplace(const_iterator pos,
+                                                        Args&&... args) {
+    size_t pos_index = pos - get_begin();
+    auto scope = trace(socow_op::insert, pos_index, 1);
+    if (is_shared()) {
+        unshare_around(pos_index, 0, 1, [&](T* dst) {
+            new (dst) T(std::forward<Args>(args)...);
+        });
+        return get_begin() + pos_index;
+    }
+    emplace_back(std::forward<Args>(args)...);
+    T* cur_data = get_begin();
+    if constexpr (is_trivially_relocatable_v<T>) {
+        std::aligned_storage_t<sizeof(T), alignof(T)> tmp;
+        std::memcpy(&tmp, cur_data + size() - 1, sizeof(T));
+        std::memmove(static_cast<void*>(cur_data + pos_index + 1),
+                     cur_data + pos_index,
+                     (size() - 1 - pos_index) * sizeof(T));
+        std::memcpy(static_cast<void*>(cur_data + pos_index), &tmp,
+                    sizeof(T));
+    } else {
+        std::rotate(cur_data + pos_index, cur_data + size() - 1,
+                    cur_data + size());
+    }
+    return cur_data + pos_index;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::erase(const_iterator pos) {
+    return pos == get_end() ? end() : erase(pos, pos + 1);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::erase(const_iterator first,
+                                                      const_iterator last) {
+    size_t first_index = first - get_begin();
+    size_t cnt = last - first;
+    auto scope = trace(socow_op::erase, first_index, cnt);
+    if (cnt == 0) {
+        return begin() + first_index;
+    } else if (is_shared()) {
+        unshare_around(first_index, cnt, 0, [](T*) {});
+        return get_begin() + first_index;
+    } else {
+        T* cur_data = data();
+        if constexpr (is_trivially_relocatable_v<T>) {
+            destroy_elements(cur_data + first_index, cnt);
+            std::memmove(static_cast<void*>(cur_data + first_index),
+                         cur_data + first_index + cnt,
+                         (size() - first_index - cnt) * sizeof(T));
+            size_ -= cnt << 1;
+        } else {
+            std::move(cur_data + first_index + cnt, cur_data + size(),
+                      cur_data + first_index);
+            destroy_elements(cur_data + size() - cnt, cnt);
+            size_ -= cnt << 1;
+        }
+        return cur_data + first_index;
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename Pred>
+size_t socow_vector<T, SMALL_SIZE, Policy, Allocator>::erase_if(Pred pred) {
+    socow_vector const& self = *this;
+    size_t first_index = std::find_if(self.begin(), self.end(), pred) -
+                         self.begin();
+    size_t old_size = size();
+    if (first_index == old_size) {
+        return 0;
+    }
+    if (is_shared()) {
+        erase_if_shared(first_index, pred);
+    } else {
+        T* cur_data = data();
+        T* cur_end = cur_data + old_size;
+        // pred has been called on the first erased element already, the
+        // survivors after it are moved into its place
+        T* out = cur_data + first_index;
+        T* it = out + 1;
+        if constexpr (is_trivially_relocatable_v<T>) {
+            out->~T();
+            try {
+                for (; it != cur_end; ++it) {
+                    if (pred(*it)) {
+                        it->~T();
+                    } else {
+                        std::memmove(static_cast<void*>(out++), it,
+                                     sizeof(T));
+                    }
+                }
+            } catch (...) {
+                std::memmove(static_cast<void*>(out), it,
+                             (cur_end - it) * sizeof(T));
+                size_ -= static_cast<size_t>(it - out) << 1;
+                throw;
+            }
+        } else {
+            for (; it != cur_end; ++it) {
+                if (!pred(*it)) {
+                    *out++ = std::move(*it);
+                }
+            }
+            destroy_elements(out, cur_end - out);
+        }
+        size_ -= static_cast<size_t>(cur_end - out) << 1;
+    }
+    size_t cnt = old_size - size();
+    // as if the erased elements had been next to each other
+    trace(socow_op::erase, first_index, cnt);
+    return cnt;
 }
 
-template <typename T, size_t SMALL_SIZE>
-socow_vector<T, SMALL_SIZE>&
-socow_vector<T, SMALL_SIZE>::operator=(socow_vector const& other) {
-    socow_vector(other).swap(*this);
-    return *this;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::save(int fd) const {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "only trivially copyable elements can be saved");
+    char head[socow_file_header::DATA_OFFSET] = {};
+    socow_file_header header;
+    std::memcpy(header.magic, socow_file_header::MAGIC, sizeof(header.magic));
+    header.version = socow_file_header::VERSION;
+    header.endian_mark = socow_file_header::ENDIAN_MARK;
+    header.data_offset = socow_file_header::DATA_OFFSET;
+    header.size = size();
+    header.element_size = sizeof(T);
+    header.element_align = alignof(T);
+    std::memcpy(head, &header, sizeof(header));
+    socow_write_all(fd, head, sizeof(head));
+    socow_write_all(fd, data(), size() * sizeof(T));
 }
 
-template <typename T, size_t SMALL_SIZE>
-socow_vector<T, SMALL_SIZE>::~socow_vector() {
-    if (is_static()) {
-        destruct_storage(stat_buf_, size());
-    } else {
-        destruct_storage(dyn_buf_, size());
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::load(int fd,
+                                                     Allocator const& alloc) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "only trivially copyable elements can be loaded");
+    size_t pos = 0;
+    size_t file_size = 0;
+    bool mappable = false;
+    if constexpr (dynamic_storage::mapped) {
+        mappable = socow_mappable(fd, pos, file_size);
     }
+    char head[socow_file_header::DATA_OFFSET];
+    socow_file_header header;
+    socow_read_all(fd, &header, sizeof(header));
+    if (std::memcmp(header.magic, socow_file_header::MAGIC,
+                    sizeof(header.magic)) != 0 ||
+        header.endian_mark != socow_file_header::ENDIAN_MARK) {
+        throw std::runtime_error("socow_vector: not a saved vector");
+    }
+    if (header.version != socow_file_header::VERSION ||
+        header.data_offset != socow_file_header::DATA_OFFSET) {
+        throw std::runtime_error("socow_vector: unsupported version");
+    }
+    if (header.element_size != sizeof(T) ||
+        header.element_align != alignof(T)) {
+        throw std::runtime_error("socow_vector: element type mismatch");
+    }
+    if (header.size > std::numeric_limits<size_t>::max() / 2 / sizeof(T)) {
+        throw std::runtime_error("socow_vector: size too large");
+    }
+    size_t cnt = static_cast<size_t>(header.size);
+    size_t end = socow_file_header::DATA_OFFSET + cnt * sizeof(T);
+    socow_vector result(alloc);
+    if constexpr (dynamic_storage::mapped) {
+        static_assert(socow_file_header::DATA_OFFSET >=
+                      sizeof(typename dynamic_storage::metadata));
+        if (mappable && cnt > SMALL_SIZE) {
+            if (file_size - pos < end) {
+                throw std::runtime_error("socow_vector: truncated file");
+            }
+            socow_seek(fd, pos + end);
+            dynamic_storage buf(fd, pos, socow_file_header::DATA_OFFSET, cnt,
+                                alloc);
+            result.stat_buf_.~static_storage();
+            new (&result.dyn_buf_) dynamic_storage(std::move(buf));
+            result.size_ = cnt << 1;
+            return result;
+        }
+    }
+    socow_read_all(fd, head, sizeof(head) - sizeof(header));
+    result.resize_default_init(cnt);
+    socow_read_all(fd, result.get_begin(), cnt * sizeof(T));
+    return result;
 }
 
-template <typename T, size_t SMALL_SIZE>
-T& socow_vector<T, SMALL_SIZE>::operator[](size_t i) {
-    return data()[i];
-}
-
-template <typename T, size_t SMALL_SIZE>
-T const& socow_vector<T, SMALL_SIZE>::operator[](size_t i) const {
-    return data()[i];
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+bool socow_vector<T, SMALL_SIZE, Policy, Allocator>::is_static() {
+    return size_ % 2 != 0;
 }
 
-template <typename T, size_t SMALL_SIZE>
-T* socow_vector<T, SMALL_SIZE>::data() {
-    copy_storage();
-    return is_static() ? stat_buf_.data() : dyn_buf_.data();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+bool socow_vector<T, SMALL_SIZE, Policy, Allocator>::is_static() const {
+    return size_ % 2 != 0;
 }
 
-template <typename T, size_t SMALL_SIZE>
-T const* socow_vector<T, SMALL_SIZE>::data() const {
-    return is_static() ? stat_buf_.data() : dyn_buf_.data();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::clear_storage(
+    socow_vector::dynamic_storage& buf, size_t buf_size) {
+    if (buf.release()) {
+        buf.clear(buf_size);
+        buf.deallocate();
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-size_t socow_vector<T, SMALL_SIZE>::size() const {
-    return size_ >> 1;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::destruct_storage(
+    socow_vector::static_storage& buf, size_t buf_size) {
+    buf.clear(buf_size);
+    buf.~static_storage();
 }
 
-template <typename T, size_t SMALL_SIZE>
-T& socow_vector<T, SMALL_SIZE>::front() {
-    return *begin();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::destruct_storage(
+    socow_vector::dynamic_storage& buf, size_t buf_size) {
+    clear_storage(buf, buf_size);
+    buf.~dynamic_storage();
 }
 
-template <typename T, size_t SMALL_SIZE>
-T const& socow_vector<T, SMALL_SIZE>::front() const {
-    return *begin();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::copy_elements(T const* src,
+                                                                   T* dst,
+                                                                   size_t cnt) {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        std::memcpy(static_cast<void*>(dst), src, cnt * sizeof(T));
+    } else {
+        for (size_t i = 0; i != cnt; i++) {
+            try {
+                new (dst + i) T(src[i]);
+            } catch (...) {
+                destroy_elements(dst, i);
+                throw;
+            }
+        }
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-T& socow_vector<T, SMALL_SIZE>::back() {
-    return *(end() - 1);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::move_elements(T* src,
+                                                                   T* dst,
+                                                                   size_t cnt) {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        std::memcpy(static_cast<void*>(dst), src, cnt * sizeof(T));
+    } else {
+        for (size_t i = 0; i != cnt; i++) {
+            try {
+                new (dst + i) T(std::move_if_noexcept(src[i]));
+            } catch (...) {
+                destroy_elements(dst, i);
+                throw;
+            }
+        }
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-T const& socow_vector<T, SMALL_SIZE>::back() const {
-    return *(end() - 1);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::relocate_elements(
+    T* src, T* dst, size_t cnt) {
+    if constexpr (is_trivially_relocatable_v<T>) {
+        std::memcpy(static_cast<void*>(dst), src, cnt * sizeof(T));
+    } else {
+        move_elements(src, dst, cnt);
+        destroy_elements(src, cnt);
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::push_back(T const& value) {
-    size_t val_pos = &value >= get_begin() ? &value - get_begin()
-                                           : std::numeric_limits<size_t>::max();
-    size_t cur_size = size(), cur_cap = capacity();
-    if (cur_size == cur_cap) {
-        rebuild_storage(cur_cap << 1);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::destroy_elements(
+    T* elems, size_t cnt) {
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+        for (size_t i = 0; i != cnt; i++) {
+            elems[i].~T();
+        }
     }
-    T* cur_data = data();
-    new (cur_data + cur_size) T(val_pos < cur_size ? cur_data[val_pos] : value);
-    size_ += 2;
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::pop_back() {
-    data()[size() - 1].~T();
-    size_ -= 2;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+size_t socow_vector<T, SMALL_SIZE, Policy, Allocator>::unshare_capacity(
+    size_t new_size) const {
+    return std::max(
+        Policy::unshare_capacity(new_size, capacity(), SMALL_SIZE), new_size);
 }
 
-template <typename T, size_t SMALL_SIZE>
-bool socow_vector<T, SMALL_SIZE>::empty() const {
-    return size() == 0;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::copy_storage(
+    size_t min_cap) {
+    if (is_shared()) {
+        rebuild_storage(std::max(unshare_capacity(size()), min_cap));
+    } else if (!is_static() && !dyn_buf_.prepare_write()) {
+        // the buffer could not be detached from its memfd
+        rebuild_storage(std::max(capacity(), min_cap));
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-size_t socow_vector<T, SMALL_SIZE>::capacity() const {
-    return is_static() ? SMALL_SIZE : dyn_buf_.capacity();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::truncate(size_t new_size) {
+    if (is_shared()) {
+        // copy only the elements that survive
+        rebuild_storage(unshare_capacity(new_size), new_size);
+    } else {
+        size_t cnt = size() - new_size;
+        destroy_elements(get_begin() + new_size, cnt);
+        size_ -= cnt << 1;
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::reserve(size_t new_cap) {
-    if (capacity() < new_cap) {
-        rebuild_storage(new_cap);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <bool VALUE_INIT>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::resize_init(
+    size_t new_size) {
+    size_t cur_size = size();
+    if (new_size <= cur_size) {
+        truncate(new_size);
     } else {
-        copy_storage();
+        make_room(new_size - cur_size);
+        init_elements<VALUE_INIT>(get_end(), new_size - cur_size);
+        size_ += (new_size - cur_size) << 1;
     }
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::shrink_to_fit() {
-    if (size() != capacity()) {
-        rebuild_storage(size());
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename ForwardIt>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::construct_elements(
+    ForwardIt first, T* dst, size_t cnt) {
+    if constexpr (std::is_pointer_v<ForwardIt> &&
+                  std::is_same_v<std::remove_cv_t<std::remove_pointer_t<
+                                     ForwardIt>>,
+                                 T>) {
+        copy_elements(first, dst, cnt);
+    } else {
+        for (size_t i = 0; i != cnt; i++, ++first) {
+            try {
+                new (dst + i) T(*first);
+            } catch (...) {
+                destroy_elements(dst, i);
+                throw;
+            }
+        }
     }
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::clear() {
-    copy_storage();
-    is_static() ? stat_buf_.clear(size()) : dyn_buf_.clear(size());
-    size_ = size_ % 2;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::fill_elements(
+    T const& value, T* dst, size_t cnt) {
+    for (size_t i = 0; i != cnt; i++) {
+        try {
+            new (dst + i) T(value);
+        } catch (...) {
+            destroy_elements(dst, i);
+            throw;
+        }
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::swap(socow_vector& other) {
-    if (is_static() && other.is_static()) {
-        size_t cur_size = size(), other_size = other.size();
-        static_storage tmp(stat_buf_, cur_size);
-        destruct_storage(stat_buf_, cur_size);
-        new (&stat_buf_) static_storage(other.stat_buf_, other_size);
-        destruct_storage(other.stat_buf_, other_size);
-        new (&other.stat_buf_) static_storage(tmp, cur_size);
-        tmp.clear(cur_size);
-    } else if (is_static() && !other.is_static()) {
-        swap_stat_dyn(*this, other);
-    } else if (other.is_static()) {
-        swap_stat_dyn(other, *this);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <bool VALUE_INIT>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::init_elements(T* dst,
+                                                                   size_t cnt) {
+    if constexpr (!VALUE_INIT && std::is_trivially_default_constructible_v<T>) {
+        // leave the memory uninitialized for the caller to fill
     } else {
-        dyn_buf_.swap(other.dyn_buf_);
+        for (size_t i = 0; i != cnt; i++) {
+            try {
+                if constexpr (VALUE_INIT) {
+                    new (dst + i) T();
+                } else {
+                    new (dst + i) T;
+                }
+            } catch (...) {
+                destroy_elements(dst, i);
+                throw;
+            }
+        }
     }
-    std::swap(size_, other.size_);
 }
 
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::iterator
-socow_vector<T, SMALL_SIZE>::begin() {
-    return data();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::make_room(size_t cnt) {
+    size_t new_size = size() + cnt, cur_cap = capacity();
+    if (new_size > cur_cap) {
+        rebuild_storage(std::max(new_size, Policy::grow(cur_cap)));
+    } else {
+        copy_storage(new_size);
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::iterator
-socow_vector<T, SMALL_SIZE>::end() {
-    return begin() + size();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename InputIt>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::construct_back(
+    InputIt first, InputIt last) {
+    if constexpr (is_forward_iterator<InputIt>) {
+        size_t cnt = std::distance(first, last);
+        auto scope = trace(socow_op::append, size(), cnt);
+        reserve(size() + cnt);
+        construct_elements(first, get_end(), cnt);
+        size_ += cnt << 1;
+    } else {
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::const_iterator
-socow_vector<T, SMALL_SIZE>::begin() const {
-    return data();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename Construct>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::insert_constructed(
+    size_t pos_index, size_t cnt, Construct construct) {
+    if (is_shared()) {
+        unshare_around(pos_index, 0, cnt, construct);
+        return get_begin() + pos_index;
+    }
+    make_room(cnt);
+    T* cur_data = get_begin();
+    size_t cur_size = size();
+    if constexpr (is_trivially_relocatable_v<T>) {
+        size_t tail_bytes = (cur_size - pos_index) * sizeof(T);
+        std::memmove(static_cast<void*>(cur_data + pos_index + cnt),
+                     cur_data + pos_index, tail_bytes);
+        try {
+            construct(cur_data + pos_index);
+        } catch (...) {
+            std::memmove(static_cast<void*>(cur_data + pos_index),
+                         cur_data + pos_index + cnt, tail_bytes);
+            throw;
+        }
+        size_ += cnt << 1;
+    } else {
+        construct(cur_data + cur_size);
+        size_ += cnt << 1;
+        std::rotate(cur_data + pos_index, cur_data + cur_size,
+                    cur_data + cur_size + cnt);
+    }
+    return cur_data + pos_index;
 }
 
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::const_iterator
-socow_vector<T, SMALL_SIZE>::end() const {
-    return begin() + size();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+bool socow_vector<T, SMALL_SIZE, Policy, Allocator>::is_shared() const {
+    return !is_static() && !dyn_buf_.unique();
 }
 
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::iterator
-socow_vector<T, SMALL_SIZE>::insert(const_iterator pos, T const& value) {
-    size_t pos_index = pos - get_begin();
-    push_back(value);
-    T* cur_data = data();
-    for (size_t i = size() - 1; i != pos_index; i--) {
-        std::swap(cur_data[i - 1], cur_data[i]);
-    }
-    return get_begin() + pos_index;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::trace_scope
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::trace(
+    socow_op op, size_t pos, size_t cnt, socow_vector const* other) const {
+    return trace_scope([&] {
+        if constexpr (Policy::traced) {
+            bool shared = is_shared();
+            if (op != socow_op::write || shared) {
+                Policy::trace(socow_trace_event{op, this, other, sizeof(T),
+                                                size(), shared, is_static(),
+                                                pos, cnt});
+            }
+        }
+    });
 }
 
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::iterator
-socow_vector<T, SMALL_SIZE>::erase(const_iterator pos) {
-    return pos == get_end() ? end() : erase(pos, pos + 1);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::count(
+    size_t socow_stats::*counter, size_t n) {
+    if constexpr (Policy::counted) {
+        socow_counters::local().*counter += n;
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::iterator
-socow_vector<T, SMALL_SIZE>::erase(const_iterator first, const_iterator last) {
-    size_t first_index = first - get_begin();
-    size_t cnt = last - first;
-    if (cnt == 0) {
-        return begin() + first_index;
-    } else {
-        T* cur_data = data();
-        for (size_t i = first_index; i != size() - cnt; i++) {
-            std::swap(cur_data[i], cur_data[i + cnt]);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::take_elements(
+    socow_vector& other) {
+    // moves out of a buffer only other owns, copies out of a shared one
+    size_t cnt = other.size();
+    T* src = other.dyn_buf_.data();
+    bool unique = other.dyn_buf_.unique();
+    auto build = [&](T* dst) {
+        if (unique) {
+            move_elements(src, dst, cnt);
+        } else {
+            copy_elements(src, dst, cnt);
         }
-        for (size_t i = 0; i != cnt; i++) {
-            pop_back();
+    };
+    if (cnt <= SMALL_SIZE) {
+        new (&stat_buf_) static_storage();
+        try {
+            build(stat_buf_.data());
+        } catch (...) {
+            stat_buf_.~static_storage();
+            throw;
+        }
+        size_ = (cnt << 1) + 1;
+    } else {
+        new (&dyn_buf_) dynamic_storage(cnt, this->alloc());
+        try {
+            build(dyn_buf_.data());
+        } catch (...) {
+            clear_storage(dyn_buf_, 0);
+            throw;
         }
-        return get_begin() + first_index;
     }
 }
 
-template <typename T, size_t SMALL_SIZE>
-bool socow_vector<T, SMALL_SIZE>::is_static() {
-    return size_ % 2 != 0;
-}
-
-template <typename T, size_t SMALL_SIZE>
-bool socow_vector<T, SMALL_SIZE>::is_static() const {
-    return size_ % 2 != 0;
-}
-
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::clear_storage(
-    socow_vector::dynamic_storage& buf, size_t buf_size) {
-    if (buf.ref_count() == 1) {
-        buf.clear(buf_size);
-        operator delete(buf.all_data_, dynamic_storage::meta_al);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename Construct>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::unshare_around(
+    size_t pos_index, size_t erase_cnt, size_t cnt, Construct construct) {
+    // the private copy is built straight from the shared buffer: the kept
+    // elements before and after the gap are copied, the erased ones are
+    // skipped and the inserted ones are constructed in between
+    size_t old_size = size(), new_size = old_size - erase_cnt + cnt;
+    size_t new_cap = new_size > capacity()
+                         ? std::max(new_size, Policy::grow(capacity()))
+                         : unshare_capacity(new_size);
+    size_t tail_index = pos_index + erase_cnt;
+    T const* src = dyn_buf_.data();
+    auto build = [&](T* dst) {
+        copy_elements(src, dst, pos_index);
+        try {
+            construct(dst + pos_index);
+            try {
+                copy_elements(src + tail_index, dst + pos_index + cnt,
+                              old_size - tail_index);
+            } catch (...) {
+                destroy_elements(dst + pos_index, cnt);
+                throw;
+            }
+        } catch (...) {
+            destroy_elements(dst, pos_index);
+            throw;
+        }
+    };
+    if (new_cap <= SMALL_SIZE) {
+        dynamic_storage old_dyn_buf(std::move(dyn_buf_));
+        dyn_buf_.~dynamic_storage();
+        new (&stat_buf_) static_storage();
+        try {
+            build(stat_buf_.data());
+        } catch (...) {
+            stat_buf_.~static_storage();
+            new (&dyn_buf_) dynamic_storage(std::move(old_dyn_buf));
+            throw;
+        }
+        count(&socow_stats::unshares);
+        count(&socow_stats::unshared_elements, new_size - cnt);
+        count(&socow_stats::to_static);
+        destruct_storage(old_dyn_buf, old_size);
+        size_ = (new_size << 1) + 1;
     } else {
-        --buf.ref_count();
+        dynamic_storage new_dyn_buf(new_cap, this->alloc());
+        try {
+            build(new_dyn_buf.data());
+        } catch (...) {
+            clear_storage(new_dyn_buf, 0);
+            throw;
+        }
+        count(&socow_stats::unshares);
+        count(&socow_stats::unshared_elements, new_size - cnt);
+        destruct_storage(dyn_buf_, old_size);
+        new (&dyn_buf_) dynamic_storage(std::move(new_dyn_buf));
+        size_ = new_size << 1;
     }
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::destruct_storage(
-    socow_vector::static_storage& buf, size_t buf_size) {
-    buf.clear(buf_size);
-    buf.~static_storage();
-}
-
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::destruct_storage(
-    socow_vector::dynamic_storage& buf, size_t buf_size) {
-    clear_storage(buf, buf_size);
-    buf.~dynamic_storage();
-}
-
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::copy_storage() {
-    if (!is_static() && dyn_buf_.ref_count() != 1) {
-        if (size() > SMALL_SIZE) {
-            if ((size() << 2) > capacity()) {
-                rebuild_storage(capacity());
-            } else {
-                rebuild_storage((capacity() + 1) >> 1);
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+template <typename Pred>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::erase_if_shared(
+    size_t first_index, Pred& pred) {
+    // only the elements that survive are copied out of the shared buffer
+    size_t old_size = size(), new_size = first_index;
+    size_t new_cap = unshare_capacity(old_size - 1);
+    T const* src = dyn_buf_.data();
+    auto build = [&](T* dst) {
+        copy_elements(src, dst, first_index);
+        try {
+            for (size_t i = first_index + 1; i != old_size; ++i) {
+                if (!pred(src[i])) {
+                    new (dst + new_size) T(src[i]);
+                    ++new_size;
+                }
             }
-        } else {
-            rebuild_storage(SMALL_SIZE);
+        } catch (...) {
+            destroy_elements(dst, new_size);
+            throw;
+        }
+    };
+    if (new_cap <= SMALL_SIZE) {
+        dynamic_storage old_dyn_buf(std::move(dyn_buf_));
+        dyn_buf_.~dynamic_storage();
+        new (&stat_buf_) static_storage();
+        try {
+            build(stat_buf_.data());
+        } catch (...) {
+            stat_buf_.~static_storage();
+            new (&dyn_buf_) dynamic_storage(std::move(old_dyn_buf));
+            throw;
+        }
+        count(&socow_stats::unshares);
+        count(&socow_stats::unshared_elements, new_size);
+        count(&socow_stats::to_static);
+        destruct_storage(old_dyn_buf, old_size);
+        size_ = (new_size << 1) + 1;
+    } else {
+        dynamic_storage new_dyn_buf(new_cap, this->alloc());
+        try {
+            build(new_dyn_buf.data());
+        } catch (...) {
+            clear_storage(new_dyn_buf, 0);
+            throw;
         }
+        count(&socow_stats::unshares);
+        count(&socow_stats::unshared_elements, new_size);
+        destruct_storage(dyn_buf_, old_size);
+        new (&dyn_buf_) dynamic_storage(std::move(new_dyn_buf));
+        size_ = new_size << 1;
     }
 }
 
-template <typename T, size_t SMALL_SIZE>
-T& socow_vector<T, SMALL_SIZE>::get_elem(size_t i) {
-    return is_static() ? stat_buf_.data()[i] : dyn_buf_.data()[i];
-}
-
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::iterator
-socow_vector<T, SMALL_SIZE>::get_begin() {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::get_begin() {
     return is_static() ? stat_buf_.data() : dyn_buf_.data();
 }
 
-template <typename T, size_t SMALL_SIZE>
-typename socow_vector<T, SMALL_SIZE>::iterator
-socow_vector<T, SMALL_SIZE>::get_end() {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+typename socow_vector<T, SMALL_SIZE, Policy, Allocator>::iterator
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::get_end() {
     return get_begin() + size();
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::swap_stat_dyn(socow_vector& stat_vec,
-                                                socow_vector& dyn_vec) {
-    dynamic_storage tmp = dyn_vec.dyn_buf_;
-    destruct_storage(dyn_vec.dyn_buf_, dyn_vec.size());
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::swap_stat_dyn(
+    socow_vector& stat_vec, socow_vector& dyn_vec) {
+    dynamic_storage tmp(std::move(dyn_vec.dyn_buf_));
+    dyn_vec.dyn_buf_.~dynamic_storage();
+    new (&dyn_vec.stat_buf_) static_storage();
     try {
-        new (&dyn_vec.stat_buf_)
-            static_storage(stat_vec.stat_buf_, stat_vec.size());
+        relocate_elements(stat_vec.stat_buf_.data(), dyn_vec.stat_buf_.data(),
+                          stat_vec.size());
     } catch (...) {
-        new (&dyn_vec.dyn_buf_) dynamic_storage(tmp);
-        --dyn_vec.dyn_buf_.ref_count();
+        dyn_vec.stat_buf_.~static_storage();
+        new (&dyn_vec.dyn_buf_) dynamic_storage(std::move(tmp));
         throw;
     }
-    destruct_storage(stat_vec.stat_buf_, stat_vec.size());
-    new (&stat_vec.dyn_buf_) dynamic_storage(tmp);
-    --stat_vec.dyn_buf_.ref_count();
+    stat_vec.stat_buf_.~static_storage();
+    new (&stat_vec.dyn_buf_) dynamic_storage(std::move(tmp));
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::rebuild_storage(
+    size_t new_cap) {
+    rebuild_storage(new_cap, size());
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::rebuild_storage(size_t new_cap) {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::rebuild_storage(
+    size_t new_cap, size_t new_size) {
+    size_t old_size = size();
     if (new_cap <= SMALL_SIZE && !is_static()) {
-        static_storage new_stat_buf;
-        for (size_t i = 0; i != size(); i++) {
-            try {
-                new (new_stat_buf.data() + i) T(dyn_buf_.data()[i]);
-            } catch (...) {
-                new_stat_buf.clear(i);
-                throw;
+        dynamic_storage old_dyn_buf(std::move(dyn_buf_));
+        dyn_buf_.~dynamic_storage();
+        new (&stat_buf_) static_storage();
+        try {
+            if (old_dyn_buf.unique()) {
+                relocate_elements(old_dyn_buf.data(), stat_buf_.data(),
+                                  new_size);
+                destroy_elements(old_dyn_buf.data() + new_size,
+                                 old_size - new_size);
+                old_size = 0;
+            } else {
+                copy_elements(old_dyn_buf.data(), stat_buf_.data(), new_size);
+                count(&socow_stats::unshares);
+                count(&socow_stats::unshared_elements, new_size);
             }
+        } catch (...) {
+            stat_buf_.~static_storage();
+            new (&dyn_buf_) dynamic_storage(std::move(old_dyn_buf));
+            throw;
         }
-        destruct_storage(dyn_buf_, size());
-        new (&stat_buf_) static_storage(new_stat_buf, size());
-        ++size_;
-        new_stat_buf.clear(size());
+        count(&socow_stats::to_static);
+        destruct_storage(old_dyn_buf, old_size);
+        size_ = (new_size << 1) + 1;
     } else if (new_cap > SMALL_SIZE) {
-        dynamic_storage new_dyn_buf(new_cap);
-        for (size_t i = 0; i != size(); i++) {
-            try {
-                new (new_dyn_buf.data() + i) T(get_elem(i));
-            } catch (...) {
-                clear_storage(new_dyn_buf, i);
-                throw;
+        if (is_shared() && dyn_buf_.can_map_copy(new_cap)) {
+            // the kernel copies the pages that get written
+            dynamic_storage new_dyn_buf(dyn_buf_, new_cap);
+            if (new_dyn_buf.all_data_ != nullptr) {
+                count(&socow_stats::unshares);
+                destruct_storage(dyn_buf_, old_size);
+                new (&dyn_buf_) dynamic_storage(std::move(new_dyn_buf));
+                size_ = new_size << 1;
+                return;
             }
+            // out of address space or mappings, copied as usual
+        }
+        dynamic_storage new_dyn_buf(new_cap, this->alloc());
+        try {
+            if (is_static() || dyn_buf_.unique()) {
+                relocate_elements(get_begin(), new_dyn_buf.data(), new_size);
+                destroy_elements(get_begin() + new_size, old_size - new_size);
+                old_size = 0;
+                if (!is_static()) {
+                    count(&socow_stats::reallocations);
+                    count(&socow_stats::reallocated_elements, new_size);
+                }
+            } else {
+                copy_elements(get_begin(), new_dyn_buf.data(), new_size);
+                count(&socow_stats::unshares);
+                count(&socow_stats::unshared_elements, new_size);
+            }
+        } catch (...) {
+            clear_storage(new_dyn_buf, 0);
+            throw;
         }
         if (is_static()) {
-            destruct_storage(stat_buf_, size());
-            --size_;
+            count(&socow_stats::to_dynamic);
+            destruct_storage(stat_buf_, old_size);
         } else {
-            destruct_storage(dyn_buf_, size());
+            destruct_storage(dyn_buf_, old_size);
         }
-        new (&dyn_buf_) dynamic_storage(new_dyn_buf);
-        --dyn_buf_.ref_count();
+        new (&dyn_buf_) dynamic_storage(std::move(new_dyn_buf));
+        size_ = new_size << 1;
+    } else {
+        destroy_elements(stat_buf_.data() + new_size, old_size - new_size);
+        size_ = (new_size << 1) + 1;
     }
 }
 
 /// STATIC STORAGE
-template <typename T, size_t SMALL_SIZE>
-socow_vector<T, SMALL_SIZE>::static_storage::static_storage() = default;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::static_storage::
+    static_storage() = default;
 
-template <typename T, size_t SMALL_SIZE>
-socow_vector<T, SMALL_SIZE>::static_storage::static_storage(
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::static_storage::static_storage(
     static_storage const& other, size_t stor_size)
     : static_storage() {
-    for (size_t i = 0; i != stor_size; i++) {
-        try {
-            new (&data_[i]) T(other.data()[i]);
-        } catch (...) {
-            clear(i);
-            throw;
-        }
-    }
+    copy_elements(other.data(), data(), stor_size);
 }
 
-template <typename T, size_t SMALL_SIZE>
-T* socow_vector<T, SMALL_SIZE>::static_storage::data() {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T* socow_vector<T, SMALL_SIZE, Policy, Allocator>::static_storage::data() {
     return reinterpret_cast<T*>(&data_[0]);
 }
 
-template <typename T, size_t SMALL_SIZE>
-T const* socow_vector<T, SMALL_SIZE>::static_storage::data() const {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T const*
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::static_storage::data() const {
     return reinterpret_cast<T const*>(&data_[0]);
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::static_storage::clear(size_t stor_size) {
-    for (size_t i = 0; i != stor_size; i++) {
-        data()[i].~T();
-    }
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::static_storage::clear(
+    size_t stor_size) {
+    destroy_elements(data(), stor_size);
 }
 
 /// DYNAMIC STORAGE
-template <typename T, size_t SMALL_SIZE>
-socow_vector<T, SMALL_SIZE>::dynamic_storage::dynamic_storage(size_t cap)
-    : all_data_(static_cast<metadata*>(operator new(
-          sizeof(metadata) + cap * sizeof(T), meta_al))) {
-    all_data_->capacity_ = cap;
-    all_data_->ref_count_ = 1;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    dynamic_storage(size_t cap, Allocator const& alloc) {
+    block_allocator block_alloc(alloc);
+    if constexpr (mapped && Policy::memfd_threshold != 0) {
+        if (block_count(cap) * sizeof(block) >= Policy::memfd_threshold) {
+            size_t length = mapping_length(cap);
+            int fd;
+            void* ptr = socow_map_memfd(length, fd);
+            if (ptr != nullptr) {
+                all_data_ = static_cast<metadata*>(ptr);
+                new (all_data_) metadata(
+                    (length - sizeof(metadata)) / sizeof(T), block_alloc);
+                all_data_->fd_ = fd;
+                all_data_->length_ = length;
+                return;
+            }
+            // no memfd, the buffer goes to the heap
+        }
+    }
+    if constexpr (pooled) {
+        size_t bytes = block_count(cap) * sizeof(block);
+        if (bytes <= Policy::pool_max_block_bytes) {
+            // the rest of the size class is usable too, the buffer still
+            // maps to the same class when it is freed
+            using pool = socow_block_pool<Policy>;
+            bytes = pool::round_size(bytes);
+            all_data_ = static_cast<metadata*>(pool::allocate(bytes));
+            new (all_data_)
+                metadata((bytes - sizeof(metadata)) / sizeof(T), block_alloc);
+            return;
+        }
+    }
+    if constexpr (malloced) {
+        size_t bytes = block_count(cap) * sizeof(block);
+        void* ptr = std::malloc(bytes);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        bytes = socow_usable_size(ptr, bytes);
+        all_data_ = static_cast<metadata*>(ptr);
+        new (all_data_)
+            metadata((bytes - sizeof(metadata)) / sizeof(T), block_alloc);
+        return;
+    }
+    all_data_ = reinterpret_cast<metadata*>(
+        block_traits::allocate(block_alloc, block_count(cap)));
+    new (all_data_) metadata(cap, block_alloc);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    dynamic_storage(dynamic_storage const& other)
+    : all_data_(other.all_data_) {
+    retain();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    dynamic_storage(dynamic_storage const& other, size_t cap)
+    : all_data_(nullptr) {
+    if constexpr (mapped) {
+        size_t length = mapping_length(cap);
+        void* ptr = socow_map_private(other.all_data_->fd_, length);
+        if (ptr == nullptr) {
+            return;
+        }
+        // the owner of the memfd must stop writing through to it now
+        other.all_data_->map_copied_.store(true, std::memory_order_relaxed);
+        all_data_ = static_cast<metadata*>(ptr);
+        new (all_data_) metadata((length - sizeof(metadata)) / sizeof(T),
+                                 other.all_data_->alloc());
+        all_data_->length_ = length;
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    dynamic_storage(int fd, size_t pos, size_t data_offset, size_t cnt,
+                    Allocator const& alloc)
+    : all_data_(nullptr) {
+    if constexpr (mapped) {
+        size_t page = socow_page_size();
+        size_t length =
+            (data_offset + cnt * sizeof(T) + page - 1) / page * page;
+        void* ptr = socow_map_private(fd, length, pos);
+        if (ptr == nullptr) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "socow_vector: mmap");
+        }
+        // the header takes the place of the file's own header, the elements
+        // stay where they are in the file
+        size_t offset = data_offset - sizeof(metadata);
+        all_data_ = reinterpret_cast<metadata*>(static_cast<char*>(ptr) +
+                                                offset);
+        new (all_data_) metadata(cnt, block_allocator(alloc));
+        all_data_->offset_ = offset;
+        all_data_->length_ = length;
+    }
 }
 
-template <typename T, size_t SMALL_SIZE>
-socow_vector<T, SMALL_SIZE>::dynamic_storage::dynamic_storage(
-    dynamic_storage const& other)
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    dynamic_storage(dynamic_storage&& other) noexcept
     : all_data_(other.all_data_) {
-    ++all_data_->ref_count_;
+    other.all_data_ = nullptr;
 }
 
-template <typename T, size_t SMALL_SIZE>
-size_t socow_vector<T, SMALL_SIZE>::dynamic_storage::capacity() const {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+size_t socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    capacity() const {
     return all_data_->capacity_;
 }
 
-template <typename T, size_t SMALL_SIZE>
-size_t& socow_vector<T, SMALL_SIZE>::dynamic_storage::ref_count() {
-    return all_data_->ref_count_;
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+bool
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::can_map_copy(
+    size_t cap) const {
+    if constexpr (mapped) {
+        return all_data_->fd_ >= 0 &&
+               block_count(cap) * sizeof(block) >= Policy::memfd_threshold &&
+               mapping_length(cap) <= all_data_->length_;
+    } else {
+        return false;
+    }
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+bool socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    prepare_write() {
+    if constexpr (mapped) {
+        // relaxed is enough, the copies that set the flag have released
+        // their references before this buffer became unique
+        if (all_data_->fd_ >= 0 &&
+            all_data_->map_copied_.load(std::memory_order_relaxed)) {
+            // private mappings of the memfd still read the pages they have
+            // not written from it, so it has to keep what it holds now
+            if (!socow_remap_private(all_data_->fd_, all_data_,
+                                     all_data_->length_)) {
+                return false;
+            }
+            socow_close(all_data_->fd_);
+            all_data_->fd_ = -1;
+        }
+    }
+    return true;
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+size_t
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::mapping_length(
+    size_t cap) {
+    size_t page = socow_page_size();
+    return (block_count(cap) * sizeof(block) + page - 1) / page * page;
 }
 
-template <typename T, size_t SMALL_SIZE>
-T* socow_vector<T, SMALL_SIZE>::dynamic_storage::data() {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::metadata::
+    metadata(size_t cap, block_allocator const& alloc)
+    : socow_allocator_holder<block_allocator>(alloc), capacity_(cap) {}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+size_t
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::block_count(
+    size_t cap) {
+    static_assert(alignof(metadata) <= alignof(block));
+    return (sizeof(metadata) + cap * sizeof(T) + sizeof(block) - 1) /
+           sizeof(block);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+bool socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    unique() const {
+    return all_data_->ref_count_.unique();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+size_t socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::
+    ref_count() const {
+    return all_data_->ref_count_.count();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::retain() {
+    all_data_->ref_count_.retain();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+bool
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::release() {
+    return all_data_->ref_count_.release();
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T* socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::data() {
     return all_data_->data_;
 }
 
-template <typename T, size_t SMALL_SIZE>
-T const* socow_vector<T, SMALL_SIZE>::dynamic_storage::data() const {
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+T const*
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::data() const {
     return all_data_->data_;
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::dynamic_storage::swap(
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::swap(
     dynamic_storage& other) {
     std::swap(all_data_, other.all_data_);
 }
 
-template <typename T, size_t SMALL_SIZE>
-void socow_vector<T, SMALL_SIZE>::dynamic_storage::clear(size_t stor_size) {
-    for (size_t i = 0; i != stor_size; i++) {
-        all_data_->data_[i].~T();
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::clear(
+    size_t stor_size) {
+    destroy_elements(all_data_->data_, stor_size);
+}
+
+template <typename T, size_t SMALL_SIZE, typename Policy, typename Allocator>
+void
+socow_vector<T, SMALL_SIZE, Policy, Allocator>::dynamic_storage::deallocate() {
+    block_allocator block_alloc(all_data_->alloc());
+    size_t cnt = block_count(capacity());
+    // elements are destroyed by clear(), only the allocator is left
+    using holder = socow_allocator_holder<block_allocator>;
+    static_cast<holder*>(all_data_)->~holder();
+    if constexpr (mapped) {
+        if (all_data_->length_ != 0) {
+            socow_unmap(reinterpret_cast<char*>(all_data_) -
+                            all_data_->offset_,
+                        all_data_->length_, all_data_->fd_);
+            return;
+        }
+    }
+    if constexpr (pooled) {
+        size_t bytes = cnt * sizeof(block);
+        if (bytes <= Policy::pool_max_block_bytes) {
+            using pool = socow_block_pool<Policy>;
+            pool::deallocate(all_data_, pool::round_size(bytes));
+            return;
+        }
+    }
+    if constexpr (malloced) {
+        std::free(all_data_);
+        return;
     }
+    block_traits::deallocate(block_alloc, reinterpret_cast<block*>(all_data_),
+                             cnt);
 }
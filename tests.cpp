@@ -1,15 +1,26 @@
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
+#include <sstream>
+#include <thread>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "gtest/gtest.h"
 
+#include "chunked-socow-vector.h"
+#include "socow-archive.h"
+#include "socow-trace.h"
 #include "socow-vector.h"
 
 template struct socow_vector<int, 2>;
+template struct chunked_socow_vector<int, 4>;
 
-template <typename T>
-T const& as_const(T& obj) {
-    return obj;
-}
+using std::as_const;
 
 template <typename T>
 struct element {
@@ -125,6 +136,29 @@ size_t element<T>::throw_countdown = 0;
 template <typename T>
 size_t element<T>::copy_counter = 0;
 
+struct tracked {
+    tracked() = default;
+
+    tracked(tracked const&) {
+        ++copies;
+    }
+
+    tracked(tracked&&) noexcept {}
+
+    tracked& operator=(tracked const&) {
+        ++copies;
+        return *this;
+    }
+
+    tracked& operator=(tracked&&) noexcept {
+        return *this;
+    }
+
+    static size_t copies;
+};
+
+size_t tracked::copies = 0;
+
 using container = socow_vector<element<size_t>, 2>;
 
 TEST(correctness, default_ctor) {
@@ -163,6 +197,93 @@ TEST(correctness, push_back_from_self) {
     element<size_t>::expect_no_instances();
 }
 
+TEST(correctness, push_back_rvalue) {
+    size_t const N = 500;
+    {
+        socow_vector<socow_vector<size_t, 2>, 2> a;
+        for (size_t i = 0; i != N; ++i) {
+            socow_vector<size_t, 2> tmp;
+            for (size_t j = 0; j != 5; ++j)
+                tmp.push_back(i + j);
+            size_t const* old_data = as_const(tmp).data();
+            a.push_back(std::move(tmp));
+            EXPECT_EQ(old_data, as_const(a).back().data());
+            EXPECT_TRUE(tmp.empty());
+        }
+
+        for (size_t i = 0; i != N; ++i) {
+            EXPECT_EQ(5, a[i].size());
+            EXPECT_EQ(i, a[i][0]);
+        }
+    }
+}
+
+TEST(correctness, push_back_rvalue_from_self) {
+    size_t const N = 500;
+    {
+        container a;
+        a.push_back(42);
+        for (size_t i = 0; i != N; ++i)
+            a.push_back(std::move(a.back()));
+
+        for (size_t i = 0; i != a.size(); ++i)
+            EXPECT_EQ(42, a[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, emplace_back) {
+    size_t const N = 500;
+    {
+        container a;
+        for (size_t i = 0; i != N; ++i) {
+            element<size_t>::set_copy_counter(0);
+            element<size_t>& res = a.emplace_back(i);
+            EXPECT_EQ(i, res);
+            EXPECT_EQ(&res, &a.back());
+        }
+        EXPECT_EQ(0, element<size_t>::get_copy_counter());
+
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(i, a[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, emplace_back_from_self) {
+    size_t const N = 500;
+    {
+        container a;
+        a.emplace_back(42);
+        for (size_t i = 0; i != N; ++i)
+            a.emplace_back(as_const(a)[0]);
+
+        for (size_t i = 0; i != a.size(); ++i)
+            EXPECT_EQ(42, a[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, emplace) {
+    {
+        container a;
+        for (size_t i = 0; i != 5; ++i)
+            a.push_back(i);
+
+        auto it = a.emplace(as_const(a).begin() + 2, 42);
+        EXPECT_EQ(42, *it);
+        EXPECT_TRUE(it == a.begin() + 2);
+        it = a.emplace(as_const(a).begin(), as_const(a)[5]);
+        EXPECT_TRUE(it == a.begin());
+
+        size_t const expected[] = {4, 0, 1, 42, 2, 3, 4};
+        EXPECT_EQ(7, a.size());
+        for (size_t i = 0; i != 7; ++i)
+            EXPECT_EQ(expected[i], a[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
 TEST(correctness, subscription) {
     size_t const N = 500;
     socow_vector<size_t, 2> a;
@@ -390,6 +511,152 @@ TEST(correctness, shrink_to_fit_2) {
     EXPECT_EQ(2, a.capacity());
 }
 
+TEST(correctness, count_ctor) {
+    {
+        container a(500, 42);
+        EXPECT_EQ(500, a.size());
+        EXPECT_EQ(500, a.capacity());
+        for (size_t i = 0; i != a.size(); ++i)
+            EXPECT_EQ(42, a[i]);
+
+        container b(2, 7);
+        EXPECT_EQ(2, b.size());
+        EXPECT_EQ(2, b.capacity());
+        EXPECT_EQ(7, b[1]);
+
+        container c(0, 7);
+        EXPECT_TRUE(c.empty());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, range_ctor) {
+    std::vector<size_t> src;
+    for (size_t i = 0; i != 500; ++i)
+        src.push_back(2 * i + 1);
+    {
+        element<size_t>::set_copy_counter(0);
+        container a(src.begin(), src.end());
+        EXPECT_EQ(0, element<size_t>::get_copy_counter());
+        EXPECT_EQ(500, a.size());
+        EXPECT_EQ(500, a.capacity());
+        for (size_t i = 0; i != a.size(); ++i)
+            EXPECT_EQ(2 * i + 1, a[i]);
+
+        container b = {3, 5};
+        EXPECT_EQ(2, b.size());
+        EXPECT_EQ(3, b[0]);
+        EXPECT_EQ(5, b[1]);
+
+        std::istringstream in("1 2 3 4 5");
+        socow_vector<size_t, 2> c(std::istream_iterator<size_t>(in),
+                                  std::istream_iterator<size_t>{});
+        EXPECT_EQ(5, c.size());
+        EXPECT_EQ(5, c[4]);
+
+        socow_vector<size_t, 2> d(5, 3);
+        EXPECT_EQ(5, d.size());
+        EXPECT_EQ(3, d[4]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, range_ctor_throw) {
+    std::vector<size_t> src(100, 42);
+    element<size_t>::set_throw_countdown(0);
+    std::vector<element<size_t>> elems(src.begin(), src.end());
+    element<size_t>::set_throw_countdown(50);
+    EXPECT_THROW(container(elems.begin(), elems.end()), std::runtime_error);
+    element<size_t>::set_throw_countdown(0);
+}
+
+TEST(correctness, assign) {
+    {
+        container a(500, 1);
+        a.assign(3, 42);
+        EXPECT_EQ(3, a.size());
+        EXPECT_EQ(42, a[2]);
+
+        a.assign({1, 2, 3, 4, 5});
+        EXPECT_EQ(5, a.size());
+        EXPECT_EQ(5, a[4]);
+
+        a.assign(1000, as_const(a)[1]);
+        EXPECT_EQ(1000, a.size());
+        EXPECT_EQ(2, a[999]);
+
+        container b = a;
+        std::vector<size_t> src = {7, 8};
+        b.assign(src.begin(), src.end());
+        EXPECT_EQ(2, b.size());
+        EXPECT_EQ(8, b[1]);
+        EXPECT_EQ(1000, a.size());
+
+        b = {9};
+        EXPECT_EQ(1, b.size());
+        EXPECT_EQ(9, b[0]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, append) {
+    {
+        container a = {1, 2};
+        std::vector<size_t> src(500, 3);
+        a.append(src.begin(), src.end());
+        EXPECT_EQ(502, a.size());
+        EXPECT_EQ(2, a[1]);
+        EXPECT_EQ(3, a[501]);
+
+        container b = a;
+        b.append({4, 5});
+        EXPECT_EQ(502, a.size());
+        EXPECT_EQ(504, b.size());
+        EXPECT_EQ(5, b[503]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, resize) {
+    {
+        container a;
+        a.resize(500);
+        EXPECT_EQ(500, a.size());
+
+        a.resize(3);
+        EXPECT_EQ(3, a.size());
+
+        a.resize(10, 42);
+        EXPECT_EQ(10, a.size());
+        EXPECT_EQ(42, a[3]);
+        EXPECT_EQ(42, a[9]);
+
+        a.resize(20, as_const(a)[9]);
+        EXPECT_EQ(42, a[19]);
+
+        a.resize(0);
+        EXPECT_TRUE(a.empty());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, resize_default_init) {
+    socow_vector<size_t, 2> a;
+    a.resize_default_init(100);
+    EXPECT_EQ(100, a.size());
+    size_t* ptr = a.data();
+    for (size_t i = 0; i != 100; ++i)
+        ptr[i] = i;
+    a.resize_default_init(200);
+    EXPECT_EQ(200, a.size());
+    EXPECT_EQ(99, a[99]);
+
+    socow_vector<size_t, 2> b;
+    b.resize(5);
+    for (size_t i = 0; i != 5; ++i)
+        EXPECT_EQ(0, b[i]);
+}
+
 TEST(correctness, copy_ctor) {
     size_t const N = 500;
     {
@@ -438,6 +705,81 @@ TEST(correctness, self_assignment) {
     element<size_t>::expect_no_instances();
 }
 
+TEST(correctness, move_ctor) {
+    size_t const N = 500;
+    {
+        container a;
+        for (size_t i = 0; i != N; ++i)
+            a.push_back(i);
+
+        element<size_t>::set_copy_counter(0);
+        element<size_t> const* old_data = as_const(a).data();
+        container b = std::move(a);
+        EXPECT_EQ(0, element<size_t>::get_copy_counter());
+        EXPECT_EQ(old_data, as_const(b).data());
+        EXPECT_TRUE(a.empty());
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(i, b[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, move_ctor_small) {
+    {
+        socow_vector<element<size_t>, 3> a;
+        a.push_back(41);
+        a.push_back(43);
+
+        socow_vector<element<size_t>, 3> b = std::move(a);
+        EXPECT_TRUE(a.empty());
+        EXPECT_EQ(3, a.capacity());
+        EXPECT_EQ(2, b.size());
+        EXPECT_EQ(41, b[0]);
+        EXPECT_EQ(43, b[1]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, move_assignment) {
+    size_t const N = 500;
+    {
+        container a;
+        for (size_t i = 0; i != N; ++i)
+            a.push_back(2 * i + 1);
+
+        container b;
+        b.push_back(42);
+
+        element<size_t>::set_copy_counter(0);
+        b = std::move(a);
+        EXPECT_EQ(0, element<size_t>::get_copy_counter());
+        EXPECT_TRUE(a.empty());
+        EXPECT_EQ(N, b.size());
+        for (size_t i = 0; i != N; ++i)
+            EXPECT_EQ(2 * i + 1, b[i]);
+
+        a.push_back(7);
+        b = std::move(a);
+        EXPECT_EQ(1, b.size());
+        EXPECT_EQ(7, b[0]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, move_shared) {
+    size_t const N = 500;
+    socow_vector<size_t, 2> a;
+    for (size_t i = 0; i != N; ++i)
+        a.push_back(i);
+
+    socow_vector<size_t, 2> b = a;
+    socow_vector<size_t, 2> c = std::move(b);
+    c[0] = 42;
+    EXPECT_EQ(0, a[0]);
+    EXPECT_EQ(42, c[0]);
+    EXPECT_EQ(N, c.size());
+}
+
 TEST(correctness, pop_back) {
     size_t const N = 500;
     container a;
@@ -561,6 +903,103 @@ TEST(correctness, insert_empty) {
     EXPECT_EQ(43, v[0]);
 }
 
+TEST(correctness, insert_count) {
+    {
+        container a;
+        for (size_t i = 0; i != 5; ++i)
+            a.push_back(i);
+
+        auto it = a.insert(as_const(a).begin() + 2, 3, 42);
+        EXPECT_TRUE(it == a.begin() + 2);
+        it = a.insert(as_const(a).end(), 2, as_const(a)[0]);
+        EXPECT_TRUE(it == a.begin() + 8);
+        a.insert(as_const(a).begin(), 0, 7);
+
+        size_t const expected[] = {0, 1, 42, 42, 42, 2, 3, 4, 0, 0};
+        EXPECT_EQ(10, a.size());
+        for (size_t i = 0; i != 10; ++i)
+            EXPECT_EQ(expected[i], a[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, insert_count_from_self) {
+    {
+        socow_vector<element<size_t>, 3> a;
+        a.push_back(1);
+        a.push_back(2);
+        a.insert(as_const(a).begin(), 100, as_const(a)[1]);
+
+        EXPECT_EQ(102, a.size());
+        for (size_t i = 0; i != 100; ++i)
+            EXPECT_EQ(2, a[i]);
+        EXPECT_EQ(1, a[100]);
+        EXPECT_EQ(2, a[101]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, insert_range) {
+    std::vector<size_t> src = {10, 11, 12, 13};
+    {
+        container a;
+        for (size_t i = 0; i != 3; ++i)
+            a.push_back(i);
+
+        auto it = a.insert(as_const(a).begin() + 1, src.begin(), src.end());
+        EXPECT_TRUE(it == a.begin() + 1);
+        a.insert(as_const(a).end(), {20, 21});
+
+        size_t const expected[] = {0, 10, 11, 12, 13, 1, 2, 20, 21};
+        EXPECT_EQ(9, a.size());
+        for (size_t i = 0; i != 9; ++i)
+            EXPECT_EQ(expected[i], a[i]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, insert_input_range) {
+    std::istringstream in("10 11 12");
+    socow_vector<size_t, 2> a;
+    a.push_back(0);
+    a.push_back(1);
+    a.insert(as_const(a).begin() + 1, std::istream_iterator<size_t>(in),
+             std::istream_iterator<size_t>());
+
+    size_t const expected[] = {0, 10, 11, 12, 1};
+    EXPECT_EQ(5, a.size());
+    for (size_t i = 0; i != 5; ++i)
+        EXPECT_EQ(expected[i], a[i]);
+}
+
+TEST(correctness, insert_count_integral) {
+    socow_vector<size_t, 2> a;
+    a.insert(as_const(a).begin(), 5, 3);
+    EXPECT_EQ(5, a.size());
+    for (size_t i = 0; i != 5; ++i)
+        EXPECT_EQ(3, a[i]);
+}
+
+TEST(correctness, insert_range_throw) {
+    std::vector<element<size_t>> src;
+    for (size_t i = 0; i != 10; ++i)
+        src.emplace_back(i + 100);
+    {
+        socow_vector<element<size_t>, 3> a;
+        for (size_t i = 0; i != 20; ++i)
+            a.push_back(i);
+        a.reserve(40);
+
+        element<size_t>::set_throw_countdown(5);
+        EXPECT_THROW(a.insert(as_const(a).begin() + 5, src.begin(), src.end()),
+                     std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+        EXPECT_EQ(20, a.size());
+        for (size_t i = 0; i != 20; ++i)
+            EXPECT_EQ(i, a[i]);
+    }
+}
+
 TEST(correctness, erase) {
     size_t const N = 500;
     {
@@ -735,6 +1174,59 @@ TEST(correctness, erase_4) {
     EXPECT_TRUE(v.empty());
 }
 
+TEST(correctness, erase_if) {
+    size_t const N = 500;
+    {
+        container a;
+        for (size_t i = 0; i != N; ++i)
+            a.push_back(i);
+
+        size_t removed = a.erase_if(
+            [](element<size_t> const& x) { return x != 3 && x != 7; });
+        EXPECT_EQ(N - 2, removed);
+        EXPECT_EQ(2, a.size());
+        EXPECT_EQ(3, a[0]);
+        EXPECT_EQ(7, a[1]);
+
+        // each element is tested once
+        size_t calls = 0;
+        EXPECT_EQ(1, a.erase_if([&calls](element<size_t> const& x) {
+            ++calls;
+            return x == 3;
+        }));
+        EXPECT_EQ(2, calls);
+        EXPECT_EQ(1, a.size());
+        EXPECT_EQ(7, a[0]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, erase_if_relocatable) {
+    size_t const N = 500;
+    socow_vector<socow_vector<size_t, 2>, 2> a;
+    for (size_t i = 0; i != N; ++i) {
+        a.emplace_back();
+        for (size_t j = 0; j != i % 4; ++j)
+            a.back().push_back(i);
+    }
+
+    size_t removed = a.erase_if(
+        [](socow_vector<size_t, 2> const& x) { return x.size() % 2 == 0; });
+    EXPECT_EQ(N / 2, removed);
+    EXPECT_EQ(N / 2, a.size());
+    for (size_t i = 0; i != a.size(); ++i) {
+        EXPECT_EQ(i % 2 == 0 ? 1 : 3, a[i].size());
+        EXPECT_EQ(2 * i + 1, a[i][0]);
+    }
+
+    size_t calls = 0;
+    EXPECT_EQ(N / 4, a.erase_if([&calls](socow_vector<size_t, 2> const& x) {
+        ++calls;
+        return x.size() == 3;
+    }));
+    EXPECT_EQ(N / 2, calls);
+}
+
 TEST(correctness, reallocation_throw) {
     {
         container a;
@@ -748,6 +1240,72 @@ TEST(correctness, reallocation_throw) {
     element<size_t>::expect_no_instances();
 }
 
+TEST(correctness, reallocation_moves) {
+    size_t const N = 500;
+    tracked::copies = 0;
+    socow_vector<tracked, 3> a;
+    for (size_t i = 0; i != N; ++i)
+        a.emplace_back();
+    a.shrink_to_fit();
+    while (a.size() > 2)
+        a.pop_back();
+    a.shrink_to_fit();
+    a.emplace_back();
+    a.emplace_back();
+    EXPECT_EQ(0, tracked::copies);
+
+    socow_vector<tracked, 3> b = a;
+    b.emplace_back();
+    EXPECT_EQ(4, tracked::copies);
+}
+
+struct relocatable {
+    relocatable(size_t val) : val(val) {}
+
+    relocatable(relocatable const& other) : val(other.val) {
+        ++copies;
+    }
+
+    ~relocatable() {
+        ++destructions;
+    }
+
+    size_t val;
+    static size_t copies;
+    static size_t destructions;
+};
+
+size_t relocatable::copies = 0;
+size_t relocatable::destructions = 0;
+
+template <>
+struct is_trivially_relocatable<relocatable> : std::true_type {};
+
+TEST(correctness, trivially_relocatable) {
+    static_assert(is_trivially_relocatable_v<socow_vector<size_t, 2>>);
+    static_assert(!is_trivially_relocatable_v<container>);
+
+    size_t const N = 500;
+    relocatable::copies = 0;
+    relocatable::destructions = 0;
+    {
+        socow_vector<relocatable, 3> a;
+        for (size_t i = 0; i != N; ++i)
+            a.emplace_back(i);
+        a.emplace(a.begin(), N);
+        a.erase(a.begin() + 1, a.begin() + 11);
+        while (a.size() > 2)
+            a.pop_back();
+        a.shrink_to_fit();
+
+        EXPECT_EQ(0, relocatable::copies);
+        EXPECT_EQ(N + 1 - 2, relocatable::destructions);
+        EXPECT_EQ(N, a[0].val);
+        EXPECT_EQ(10, a[1].val);
+    }
+    EXPECT_EQ(N + 1, relocatable::destructions);
+}
+
 // This test actually checks memory leak in pair with @valgrind
 TEST(correctness, copy_throw) {
     container a;
@@ -770,6 +1328,262 @@ TEST(correctness, iter_types) {
     EXPECT_TRUE(test2);
 }
 
+struct arena {
+    size_t allocated = 0;
+    size_t deallocated = 0;
+};
+
+template <typename T>
+struct arena_allocator {
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+
+    explicit arena_allocator(arena* owner) : owner(owner) {}
+
+    template <typename U>
+    arena_allocator(arena_allocator<U> const& other) : owner(other.owner) {}
+
+    T* allocate(size_t n) {
+        owner->allocated += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        owner->deallocated += n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(arena_allocator<U> const& other) const {
+        return owner == other.owner;
+    }
+
+    template <typename U>
+    bool operator!=(arena_allocator<U> const& other) const {
+        return owner != other.owner;
+    }
+
+    arena* owner;
+};
+
+TEST(correctness, allocator) {
+    static_assert(sizeof(socow_vector<int, 2>) ==
+                  sizeof(size_t) + std::max(sizeof(void*), 2 * sizeof(int)));
+
+    using vector = socow_vector<element<size_t>, 3, socow_default_policy,
+                                arena_allocator<element<size_t>>>;
+    arena first, second;
+    {
+        vector a{arena_allocator<element<size_t>>(&first)};
+        for (size_t i = 0; i != 100; ++i)
+            a.push_back(i);
+        EXPECT_EQ(&first, a.get_allocator().owner);
+        EXPECT_NE(0, first.allocated);
+
+        vector b{arena_allocator<element<size_t>>(&second)};
+        b = a;
+        EXPECT_EQ(&second, b.get_allocator().owner);
+        EXPECT_EQ(as_const(a).data(), as_const(b).data());
+
+        vector c{arena_allocator<element<size_t>>(&second)};
+        c.push_back(0);
+        c.push_back(1);
+        c.push_back(2);
+        c.push_back(3);
+        c = std::move(b);
+        EXPECT_EQ(&second, c.get_allocator().owner);
+        EXPECT_EQ(second.allocated, second.deallocated);
+        EXPECT_EQ(as_const(a).data(), as_const(c).data());
+
+        // the unshared copy is made with c's own allocator
+        c[0] = 42;
+        EXPECT_NE(second.allocated, second.deallocated);
+        EXPECT_EQ(0, a[0]);
+        EXPECT_EQ(42, c[0]);
+    }
+    EXPECT_EQ(first.allocated, first.deallocated);
+    EXPECT_EQ(second.allocated, second.deallocated);
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, pmr_allocator) {
+    std::array<std::byte, 4096> buffer;
+    std::pmr::monotonic_buffer_resource resource(
+        buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+    pmr_socow_vector<size_t, 2> a(&resource);
+    for (size_t i = 0; i != 100; ++i)
+        a.push_back(i);
+    pmr_socow_vector<size_t, 2> b = a;
+    b.push_back(100);
+
+    EXPECT_EQ(&resource, a.get_allocator().resource());
+    EXPECT_GE(as_const(a).data(), reinterpret_cast<size_t*>(buffer.data()));
+    EXPECT_LT(as_const(a).data(),
+              reinterpret_cast<size_t*>(buffer.data() + buffer.size()));
+    EXPECT_EQ(99, a.back());
+    EXPECT_EQ(100, b.back());
+}
+
+TEST(correctness, pmr_move_unequal) {
+    std::array<std::byte, 4096> first_buffer, second_buffer;
+    std::pmr::monotonic_buffer_resource first(first_buffer.data(),
+                                              first_buffer.size(),
+                                              std::pmr::null_memory_resource());
+    std::pmr::monotonic_buffer_resource second(
+        second_buffer.data(), second_buffer.size(),
+        std::pmr::null_memory_resource());
+    auto in_second = [&](size_t const* ptr) {
+        return ptr >= reinterpret_cast<size_t*>(second_buffer.data()) &&
+               ptr < reinterpret_cast<size_t*>(second_buffer.data() +
+                                               second_buffer.size());
+    };
+
+    pmr_socow_vector<size_t, 2> a(&first);
+    for (size_t i = 0; i != 100; ++i)
+        a.push_back(i);
+    pmr_socow_vector<size_t, 2> b(std::move(a), &second);
+    EXPECT_EQ(0, a.size());
+    EXPECT_EQ(100, b.size());
+    EXPECT_TRUE(in_second(as_const(b).data()));
+    EXPECT_EQ(99, b.back());
+
+    pmr_socow_vector<size_t, 2> c(&first);
+    for (size_t i = 0; i != 50; ++i)
+        c.push_back(i);
+    pmr_socow_vector<size_t, 2> d = c;
+    b = std::move(d);
+    EXPECT_EQ(&second, b.get_allocator().resource());
+    EXPECT_TRUE(in_second(as_const(b).data()));
+    EXPECT_EQ(50, b.size());
+    EXPECT_EQ(49, b.back());
+    EXPECT_EQ(50, c.size());
+}
+
+struct small_pool_policy : socow_pooled_policy {
+    static constexpr size_t pool_max_bytes = 1024;
+    static constexpr size_t pool_max_block_bytes = 256;
+};
+
+TEST(correctness, pooled_buffers) {
+    using pool = socow_block_pool<small_pool_policy>;
+    using vector = socow_vector<element<size_t>, 2, small_pool_policy>;
+    pool::trim();
+    pool::reset_stats();
+
+    for (size_t k = 0; k != 10; ++k) {
+        vector a;
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i);
+        vector b = a;
+        b[0] = 42;
+        EXPECT_EQ(0, a[0]);
+        EXPECT_EQ(42, b[0]);
+    }
+    socow_pool_stats stats = pool::stats();
+    EXPECT_NE(0, stats.misses);
+    EXPECT_LT(stats.misses, 10);
+    EXPECT_GT(stats.hits, stats.misses);
+    EXPECT_NE(0, stats.retained_bytes);
+    EXPECT_LE(stats.retained_bytes, small_pool_policy::pool_max_bytes);
+
+    {
+        // too big for the pool
+        vector a;
+        a.reserve(1000);
+        EXPECT_EQ(1000, a.capacity());
+        vector b;
+        b.reserve(5);
+        EXPECT_GE(b.capacity(), 5);
+    }
+    EXPECT_EQ(stats.misses, pool::stats().misses);
+
+    pool::trim();
+    EXPECT_EQ(0, pool::stats().retained_bytes);
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness, growth_policy) {
+    socow_vector<element<size_t>, 2, socow_growth_policy<3, 2>> a;
+    std::vector<size_t> capacities;
+    for (size_t i = 0; i != 10; ++i) {
+        a.push_back(i);
+        if (capacities.empty() || capacities.back() != a.capacity())
+            capacities.push_back(a.capacity());
+    }
+    EXPECT_EQ((std::vector<size_t>{2, 3, 4, 6, 9, 13}), capacities);
+    for (size_t i = 0; i != 10; ++i)
+        EXPECT_EQ(i, a[i]);
+}
+
+TEST(correctness, usable_size_policy) {
+    using policy = socow_usable_size_policy<socow_growth_policy<3, 2>>;
+    {
+        socow_vector<element<size_t>, 2, policy> a;
+        a.reserve(5);
+        EXPECT_LE(5, a.capacity());
+        size_t cap = a.capacity();
+        for (size_t i = 0; i != cap; ++i)
+            a.push_back(i);
+        EXPECT_EQ(cap, a.capacity());
+        a.push_back(cap);
+        EXPECT_LE(cap + cap / 2, a.capacity());
+
+        auto b = a;
+        b.push_back(42);
+        for (size_t i = 0; i <= cap; ++i) {
+            EXPECT_EQ(i, a[i]);
+            EXPECT_EQ(i, b[i]);
+        }
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness_cow, unshare_policy) {
+    {
+        socow_vector<element<size_t>, 2> a;
+        a.reserve(16);
+        for (size_t i = 0; i != 3; ++i)
+            a.push_back(i);
+        auto b = a;
+        b[0] = 42;
+        EXPECT_EQ(8, b.capacity());
+    }
+    {
+        socow_vector<element<size_t>, 2, socow_unshare_keep_policy<>> a;
+        a.reserve(16);
+        for (size_t i = 0; i != 3; ++i)
+            a.push_back(i);
+        auto b = a;
+        b[0] = 42;
+        EXPECT_EQ(16, b.capacity());
+        EXPECT_EQ(0, a[0]);
+    }
+    {
+        socow_vector<element<size_t>, 2, socow_unshare_shrink_policy<>> a;
+        a.reserve(16);
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i);
+        auto b = a;
+        b[0] = 42;
+        EXPECT_EQ(10, b.capacity());
+        EXPECT_EQ(0, a[0]);
+    }
+    {
+        socow_vector<element<size_t>, 2, socow_unshare_grow_policy<2, 1>> a;
+        a.reserve(16);
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i);
+        auto b = a;
+        b.push_back(10);
+        EXPECT_EQ(20, b.capacity());
+        for (size_t i = 0; i != 9; ++i)
+            b.push_back(i);
+        EXPECT_EQ(20, b.capacity());
+        EXPECT_EQ(10, a.size());
+    }
+    element<size_t>::expect_no_instances();
+}
+
 TEST(correctness_cow, copy_ctor) {
     container a;
     for (size_t i = 0; i != 4; ++i)
@@ -914,6 +1728,61 @@ TEST(correctness_cow, push_back) {
     EXPECT_EQ(2, b[4]);
 }
 
+TEST(correctness_cow, push_back_full_small) {
+    {
+        socow_vector<element<size_t>, 2> a;
+        a.reserve(10);
+        a.push_back(1);
+        a.push_back(2);
+
+        socow_vector<element<size_t>, 2> b = a;
+        a.push_back(3);
+        EXPECT_LE(a.size(), a.capacity());
+        EXPECT_EQ(3, a.size());
+        EXPECT_EQ(3, a[2]);
+        EXPECT_EQ(2, b.size());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness_cow, resize_shrink) {
+    size_t const N = 500;
+    {
+        container a;
+        for (size_t i = 0; i != N; ++i)
+            a.push_back(i);
+
+        container b = a;
+        element<size_t>::set_copy_counter(0);
+        b.resize(10);
+        EXPECT_EQ(10, element<size_t>::get_copy_counter());
+        EXPECT_EQ(10, b.size());
+        EXPECT_EQ(N, a.size());
+        EXPECT_EQ(9, b[9]);
+
+        container c = a;
+        element<size_t>::set_copy_counter(0);
+        c.resize(1);
+        EXPECT_EQ(1, element<size_t>::get_copy_counter());
+        EXPECT_EQ(2, c.capacity());
+        EXPECT_EQ(0, c[0]);
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(correctness_cow, reserve_small) {
+    {
+        socow_vector<element<size_t>, 2> a;
+        a.reserve(10);
+        a.push_back(1);
+
+        socow_vector<element<size_t>, 2> b = a;
+        a.reserve(5);
+        EXPECT_LE(5, a.capacity());
+    }
+    element<size_t>::expect_no_instances();
+}
+
 TEST(correctness_cow, pop_back) {
     container a;
     a.reserve(5);
@@ -1103,6 +1972,567 @@ TEST(correctness_cow, erase_single_user) {
     EXPECT_EQ(old_data, reinterpret_cast<uintptr_t>(as_const(a).data()));
 }
 
+TEST(correctness_cow, erase_if_none) {
+    socow_vector<size_t, 2> a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+
+    socow_vector<size_t, 2> b = a;
+    EXPECT_EQ(0, b.erase_if([](size_t x) { return x > 100; }));
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+    EXPECT_EQ(5, b.erase_if([](size_t x) { return x % 2 == 1; }));
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+    EXPECT_EQ(10, a.size());
+    EXPECT_EQ(8, b[4]);
+}
+
+TEST(correctness_cow, copy_only_survivors) {
+    size_t const N = 100;
+    socow_vector<tracked, 2> a(N, tracked());
+    {
+        auto b = a;
+        tracked::copies = 0;
+        b.clear();
+        EXPECT_EQ(0, tracked::copies);
+        EXPECT_EQ(0, b.size());
+    }
+    {
+        auto b = a;
+        tracked::copies = 0;
+        b.pop_back();
+        EXPECT_EQ(N - 1, tracked::copies);
+    }
+    {
+        auto b = a;
+        tracked::copies = 0;
+        b.erase(as_const(b).begin() + 10, as_const(b).begin() + 60);
+        EXPECT_EQ(N - 50, tracked::copies);
+        EXPECT_EQ(N - 50, b.size());
+    }
+    {
+        auto b = a;
+        tracked::copies = 0;
+        b.insert(as_const(b).begin() + 10, 5, tracked());
+        EXPECT_EQ(N + 5, tracked::copies);
+        EXPECT_EQ(N + 5, b.size());
+    }
+    {
+        auto b = a;
+        tracked::copies = 0;
+        b.emplace(as_const(b).begin() + 10);
+        EXPECT_EQ(N, tracked::copies);
+    }
+    {
+        auto b = a;
+        tracked::copies = 0;
+        size_t calls = 0;
+        EXPECT_EQ(N / 2, b.erase_if([&calls](tracked const&) {
+            return calls++ % 2 == 1;
+        }));
+        EXPECT_EQ(N, calls);
+        EXPECT_EQ(N / 2, tracked::copies);
+        EXPECT_EQ(N / 2, b.size());
+    }
+    EXPECT_EQ(N, a.size());
+}
+
+TEST(correctness_cow, erase_shared) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+    container b = a;
+    auto it = b.erase(as_const(b).begin() + 2, as_const(b).begin() + 9);
+    EXPECT_EQ(as_const(b).begin() + 2, it);
+    EXPECT_EQ(3, b.size());
+    EXPECT_EQ(0, b[0]);
+    EXPECT_EQ(1, b[1]);
+    EXPECT_EQ(9, b[2]);
+    EXPECT_EQ(10, a.size());
+    EXPECT_EQ(2, a[2]);
+}
+
+TEST(correctness_cow, insert_shared_throw) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+    container b = a;
+    element<size_t>::set_throw_countdown(7);
+    EXPECT_THROW(b.insert(as_const(b).begin() + 5, 3, 42),
+                 std::runtime_error);
+    element<size_t>::set_throw_countdown(0);
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+    for (size_t i = 0; i != 10; ++i)
+        EXPECT_EQ(i, b[i]);
+}
+
+TEST(correctness_cow, mutable_span) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+    container b = a;
+    socow_span<element<size_t>> span = b.mutable_span();
+    EXPECT_NE(as_const(a).data(), span.data());
+    EXPECT_EQ(as_const(b).data(), span.data());
+    EXPECT_EQ(10, span.size());
+    for (size_t i = 0; i != span.size(); ++i)
+        span[i] = 2 * i;
+    for (size_t i = 0; i != 10; ++i) {
+        EXPECT_EQ(i, a[i]);
+        EXPECT_EQ(2 * i, b[i]);
+    }
+    EXPECT_EQ(span.data(), b.unique_data());
+}
+
+TEST(correctness_cow, lazy_view) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+    container b = a;
+
+    size_t sum = 0;
+    for (element<size_t> const& x : b.lazy())
+        sum += static_cast<size_t>(&x - as_const(b).data());
+    EXPECT_EQ(45, sum);
+    auto view = b.lazy();
+    EXPECT_EQ(10, view.end() - view.begin());
+    EXPECT_EQ(view.begin() + 3,
+              std::find(view.begin(), view.end(), element<size_t>(3)));
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+
+    view[3] = view[7];
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+    EXPECT_EQ(3, a[3]);
+    EXPECT_EQ(7, b[3]);
+
+    std::fill(view.begin(), view.begin() + 2, element<size_t>(42));
+    EXPECT_EQ(42, b[0]);
+    EXPECT_EQ(42, b[1]);
+    EXPECT_EQ(0, a[0]);
+
+    // the value lives in the buffer that the assignment unshares
+    container c = b;
+    c.lazy()[0] = as_const(c)[9];
+    c.lazy()[1] = c.lazy()[8];
+    EXPECT_EQ(9, c[0]);
+    EXPECT_EQ(8, c[1]);
+    EXPECT_EQ(42, b[0]);
+    EXPECT_EQ(42, b[1]);
+}
+
+TEST(correctness_cow, memfd_buffers) {
+    using vector = socow_vector<size_t, 2, socow_memfd_policy<4096>>;
+    size_t const N = 100000;
+    vector a;
+    for (size_t i = 0; i != N; ++i)
+        a.push_back(i);
+
+    vector b = a;
+    b[0] = 42;
+    b[N / 2] = 43;
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+    EXPECT_EQ(0, a[0]);
+    EXPECT_EQ(N / 2, a[N / 2]);
+    EXPECT_EQ(42, b[0]);
+    EXPECT_EQ(43, b[N / 2]);
+    for (size_t i = 1; i != N; ++i) {
+        if (i != N / 2) {
+            EXPECT_EQ(i, as_const(b)[i]);
+        }
+    }
+
+    // a stops writing through to the file that b still reads from
+    a[1] = 44;
+    EXPECT_EQ(1, as_const(b)[1]);
+    vector c = a;
+    c[2] = 45;
+    EXPECT_EQ(44, c[1]);
+    EXPECT_EQ(2, a[2]);
+
+    vector d = b;
+    d.resize(N / 4);
+    d.push_back(46);
+    EXPECT_EQ(42, d[0]);
+    EXPECT_EQ(N / 4 - 1, d[N / 4 - 1]);
+    EXPECT_EQ(46, d.back());
+    EXPECT_EQ(N, b.size());
+    EXPECT_EQ(N - 1, b.back());
+}
+
+TEST(correctness_cow, memfd_many_copies) {
+    // more unshared copies than a process usually has descriptors
+    using vector = socow_vector<size_t, 2, socow_memfd_policy<4096>>;
+    size_t const N = 1024, COPIES = 2000;
+    vector a;
+    for (size_t i = 0; i != N; ++i)
+        a.push_back(i);
+    std::vector<vector> copies(COPIES, a);
+    for (size_t k = 0; k != COPIES; ++k)
+        copies[k][0] = k;
+    for (size_t k = 0; k != COPIES; ++k) {
+        EXPECT_EQ(k, as_const(copies[k])[0]);
+        EXPECT_EQ(N - 1, as_const(copies[k]).back());
+    }
+    a[N - 1] = 0;
+    EXPECT_EQ(N - 1, as_const(copies[COPIES - 1]).back());
+}
+
+TEST(correctness_cow, save_load) {
+    using vector = socow_vector<size_t, 2, socow_mapped_file_policy<>>;
+    size_t const N = 10000;
+    socow_vector<size_t, 2> a;
+    for (size_t i = 0; i != N; ++i)
+        a.push_back(i);
+    socow_vector<size_t, 2> small = {1, 2};
+
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    int fd = fileno(file);
+    a.save(fd);
+    small.save(fd);
+    std::rewind(file);
+
+    vector b = vector::load(fd);
+    vector c = vector::load(fd);
+    ASSERT_EQ(N, b.size());
+    for (size_t i = 0; i != N; ++i)
+        EXPECT_EQ(i, as_const(b)[i]);
+    EXPECT_EQ(2, c.size());
+    EXPECT_EQ(2, c[1]);
+
+    // a shared mapping is copied by the first write
+    vector d = b;
+    size_t const* mapped = as_const(b).data();
+    // the elements stay where they are in the file
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(mapped) % 4096);
+    b[0] = 42;
+    EXPECT_NE(mapped, as_const(b).data());
+    EXPECT_EQ(mapped, as_const(d).data());
+    EXPECT_EQ(0, d[0]);
+    d.push_back(N);
+    EXPECT_EQ(N + 1, d.size());
+    EXPECT_EQ(N - 1, d[N - 1]);
+
+    // the only owner of a mapping writes to it in place, so elements of it
+    // can be written back into it
+    std::rewind(file);
+    vector w = vector::load(fd);
+    mapped = as_const(w).data();
+    w[0] = as_const(w)[N - 1];
+    w.lazy()[1] = w.lazy()[N - 2];
+    EXPECT_EQ(mapped, as_const(w).data());
+    w.push_back(as_const(w)[N - 3]);
+    ASSERT_EQ(N + 1, w.size());
+    EXPECT_EQ(N - 1, w[0]);
+    EXPECT_EQ(N - 2, w[1]);
+    EXPECT_EQ(N - 3, w[N]);
+
+    struct wide {
+        size_t a[4];
+    };
+    using wide_vector = socow_vector<wide, 2, socow_mapped_file_policy<>>;
+    std::FILE* wide_file = std::tmpfile();
+    ASSERT_NE(nullptr, wide_file);
+    int wide_fd = fileno(wide_file);
+    {
+        socow_vector<wide, 2> x;
+        for (size_t i = 0; i != N; ++i)
+            x.push_back({{i, i, i, i}});
+        x.save(wide_fd);
+    }
+    std::rewind(wide_file);
+    wide_vector y = wide_vector::load(wide_fd);
+    y[0] = as_const(y)[N - 1];
+    y.lazy()[1] = y.lazy()[N - 2];
+    y.push_back(as_const(y)[N - 3]);
+    ASSERT_EQ(N + 1, y.size());
+    EXPECT_EQ(N - 1, y[0].a[3]);
+    EXPECT_EQ(N - 2, y[1].a[3]);
+    EXPECT_EQ(N - 3, y[N].a[3]);
+    std::fclose(wide_file);
+
+    std::rewind(file);
+    socow_vector<size_t, 2> e = socow_vector<size_t, 2>::load(fd);
+    EXPECT_EQ(a.size(), e.size());
+    EXPECT_TRUE(std::equal(a.begin(), a.end(), e.begin()));
+
+    std::rewind(file);
+    EXPECT_THROW((socow_vector<int, 2>::load(fd)), std::runtime_error);
+    uint64_t huge = std::numeric_limits<uint64_t>::max();
+    ASSERT_EQ(sizeof(huge),
+              pwrite(fd, &huge, sizeof(huge),
+                     offsetof(socow_file_header, size)));
+    std::rewind(file);
+    try {
+        vector::load(fd);
+        ADD_FAILURE() << "a size that does not fit is not rejected";
+    } catch (std::runtime_error const& e) {
+        EXPECT_STREQ("socow_vector: size too large", e.what());
+    }
+    std::rewind(file);
+    std::fputs("not a vector", file);
+    std::rewind(file);
+    EXPECT_THROW(vector::load(fd), std::runtime_error);
+    std::fclose(file);
+}
+
+TEST(correctness_cow, archive) {
+    using vector = socow_vector<size_t, 2>;
+    vector a;
+    for (size_t i = 0; i != 1000; ++i)
+        a.push_back(i);
+    vector b = a;
+    vector c = a;
+    vector d = {1, 2};
+    vector e = a;
+    e[0] = 42;
+    vector f = e;
+
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    int fd = fileno(file);
+    {
+        socow_archive_writer<vector> writer(fd);
+        for (vector const* vec : {&a, &d, &b, &e, &c, &f})
+            writer.write(*vec);
+    }
+    // one copy of each buffer, plus the headers and ids
+    EXPECT_GT(size_t(3 * 8 * 1000), size_t(std::ftell(file)));
+    std::rewind(file);
+
+    std::vector<vector> loaded;
+    {
+        socow_archive_reader<vector> reader(fd);
+        for (size_t i = 0; i != 6; ++i)
+            loaded.push_back(reader.read());
+    }
+    EXPECT_EQ(3, loaded[0].ref_count());
+    EXPECT_EQ(as_const(loaded[0]).data(), as_const(loaded[2]).data());
+    EXPECT_EQ(as_const(loaded[0]).data(), as_const(loaded[4]).data());
+    EXPECT_EQ(2, loaded[3].ref_count());
+    EXPECT_EQ(as_const(loaded[3]).data(), as_const(loaded[5]).data());
+    EXPECT_EQ(1, loaded[1].ref_count());
+    EXPECT_TRUE(std::equal(a.begin(), a.end(), as_const(loaded[4]).begin()));
+    EXPECT_EQ(42, as_const(loaded[5])[0]);
+    EXPECT_EQ(1, as_const(loaded[5])[1]);
+    EXPECT_EQ(2, as_const(loaded[1])[1]);
+
+    loaded[2][0] = 43;
+    EXPECT_EQ(2, loaded[0].ref_count());
+    EXPECT_EQ(0, as_const(loaded[0])[0]);
+
+    std::rewind(file);
+    using int_reader = socow_archive_reader<socow_vector<int, 2>>;
+    EXPECT_THROW(int_reader{fd}, std::runtime_error);
+    std::fclose(file);
+}
+
+TEST(correctness_cow, trace) {
+    using vector = socow_vector<int, 2, socow_traced_policy<>>;
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    int fd = fileno(file);
+    socow_trace_recorder::start(fd);
+    {
+        vector a;
+        a.push_back(1);
+        a.append({2, 3});
+        vector b = a;
+        b[0] = 4;
+        b[1] = 5;
+        b.insert(as_const(b).begin() + 1, 6);
+        a.erase(as_const(a).begin());
+        a = b;
+    }
+    socow_trace_recorder::stop();
+    std::rewind(file);
+
+    socow_trace_header header;
+    ASSERT_EQ(1, std::fread(&header, sizeof(header), 1, file));
+    EXPECT_EQ(sizeof(socow_trace_record), header.record_size);
+    std::vector<socow_trace_record> records(12);
+    ASSERT_EQ(10, std::fread(records.data(), sizeof(socow_trace_record),
+                             records.size(), file));
+    records.resize(10);
+    std::fclose(file);
+
+    // operations made on behalf of others, and writes that do not unshare,
+    // are left out
+    socow_op const ops[] = {socow_op::create,  socow_op::append,
+                            socow_op::append,  socow_op::copy,
+                            socow_op::write,   socow_op::insert,
+                            socow_op::erase,   socow_op::assign,
+                            socow_op::destroy, socow_op::destroy};
+    for (size_t i = 0; i != records.size(); ++i)
+        EXPECT_EQ(uint8_t(ops[i]), records[i].op) << i;
+    EXPECT_EQ(2, records[2].count);
+    EXPECT_EQ(1, records[2].size);
+    EXPECT_EQ(records[0].id, records[3].other);
+    EXPECT_NE(records[0].id, records[3].id);
+    EXPECT_EQ(socow_trace_record::SHARED, records[4].flags);
+    EXPECT_EQ(sizeof(int), records[4].element_size);
+    EXPECT_EQ(1, records[5].pos);
+    EXPECT_EQ(records[3].id, records[7].other);
+}
+
+TEST(correctness_cow, counters) {
+    using vector = socow_vector<int, 2, socow_counted_policy<>>;
+    socow_counters::reset_stats();
+    vector a;
+    a.push_back(1);
+    a.push_back(2);
+    EXPECT_EQ(0, socow_counters::stats().to_dynamic);
+    a.push_back(3);
+    EXPECT_EQ(1, socow_counters::stats().to_dynamic);
+    while (a.size() != a.capacity())
+        a.push_back(4);
+    size_t old_size = a.size();
+    a.push_back(5);
+    socow_stats stats = socow_counters::stats();
+    EXPECT_EQ(1, stats.reallocations);
+    EXPECT_EQ(old_size, stats.reallocated_elements);
+    EXPECT_EQ(0, stats.unshares);
+
+    vector b = a;
+    EXPECT_EQ(0, socow_counters::stats().unshares);
+    b[0] = 6;
+    stats = socow_counters::stats();
+    EXPECT_EQ(1, stats.unshares);
+    EXPECT_EQ(a.size(), stats.unshared_elements);
+    EXPECT_EQ(1, stats.reallocations);
+
+    b.resize(1);
+    b.shrink_to_fit();
+    EXPECT_EQ(1, socow_counters::stats().to_static);
+
+    // no elements move when a shared buffer is let go
+    vector c = a;
+    c.clear();
+    EXPECT_EQ(1, socow_counters::stats().to_static);
+
+    socow_counters::reset_stats();
+    socow_vector<int, 2> d;
+    for (int i = 0; i != 10; ++i)
+        d.push_back(i);
+    socow_vector<int, 2> e = d;
+    e[0] = 1;
+    stats = socow_counters::stats();
+    EXPECT_EQ(0, stats.to_dynamic);
+    EXPECT_EQ(0, stats.reallocations);
+    EXPECT_EQ(0, stats.unshares);
+}
+
+TEST(correctness_cow, thread_safe_copies) {
+    using vector = socow_vector<size_t, 2, socow_thread_safe_policy>;
+    size_t const N = 1000, THREADS = 8;
+    vector a;
+    for (size_t i = 0; i != N; ++i)
+        a.push_back(i);
+
+    std::vector<std::thread> workers;
+    std::vector<size_t> sums(THREADS);
+    for (size_t t = 0; t != THREADS; ++t) {
+        workers.emplace_back([&a, &sums, t] {
+            for (size_t k = 0; k != 100; ++k) {
+                vector b = a;
+                size_t sum = 0;
+                for (size_t x : as_const(b))
+                    sum += x;
+                b[0] = t;
+                b.push_back(t);
+                sums[t] = sum + b[0] + b.back();
+            }
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+
+    for (size_t t = 0; t != THREADS; ++t)
+        EXPECT_EQ(N * (N - 1) / 2 + 2 * t, sums[t]);
+    EXPECT_EQ(0, a[0]);
+}
+
+TEST(chunked, push_pop) {
+    {
+        chunked_socow_vector<element<size_t>, 4> a;
+        for (size_t i = 0; i != 50; ++i)
+            a.push_back(i);
+        EXPECT_EQ(50, a.size());
+        for (size_t i = 0; i != 50; ++i)
+            EXPECT_EQ(i, as_const(a)[i]);
+        for (size_t i = 0; i != 23; ++i)
+            a.pop_back();
+        EXPECT_EQ(27, a.size());
+        EXPECT_EQ(26, a.back());
+        a.back() = 42;
+        EXPECT_EQ(42, as_const(a).back());
+        EXPECT_EQ(0, as_const(a).front());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(chunked, write_copies_one_chunk) {
+    size_t const N = 1000, CHUNK = 64;
+    chunked_socow_vector<tracked, CHUNK> a;
+    for (size_t i = 0; i != N; ++i)
+        a.emplace_back();
+    auto b = a;
+    tracked::copies = 0;
+    b[500] = tracked();
+    EXPECT_EQ(CHUNK, tracked::copies);
+    b[510] = tracked();
+    EXPECT_EQ(CHUNK, tracked::copies);
+
+    tracked::copies = 0;
+    b.push_back(tracked());
+    EXPECT_EQ(N % CHUNK, tracked::copies);
+
+    tracked::copies = 0;
+    auto c = a;
+    c.pop_back();
+    EXPECT_EQ(N % CHUNK - 1, tracked::copies);
+    EXPECT_EQ(N, a.size());
+    EXPECT_EQ(N + 1, b.size());
+    EXPECT_EQ(N - 1, c.size());
+}
+
+TEST(chunked, shared) {
+    {
+        chunked_socow_vector<element<size_t>, 4> a;
+        for (size_t i = 0; i != 30; ++i)
+            a.push_back(i);
+        auto b = a;
+        auto c = a;
+        b[5] = 100;
+        c.pop_back();
+        c.pop_back();
+        a.clear();
+        for (size_t i = 0; i != 30; ++i)
+            EXPECT_EQ(i == 5 ? 100 : i, as_const(b)[i]);
+        EXPECT_EQ(28, c.size());
+        for (size_t i = 0; i != 28; ++i)
+            EXPECT_EQ(i, as_const(c)[i]);
+        EXPECT_TRUE(a.empty());
+    }
+    element<size_t>::expect_no_instances();
+}
+
+TEST(chunked, write_throw) {
+    {
+        chunked_socow_vector<element<size_t>, 4> a;
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i);
+        auto b = a;
+        element<size_t>::set_throw_countdown(2);
+        EXPECT_THROW(b[5] = 42, std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+        for (size_t i = 0; i != 10; ++i) {
+            EXPECT_EQ(i, as_const(a)[i]);
+            EXPECT_EQ(i, as_const(b)[i]);
+        }
+    }
+    element<size_t>::expect_no_instances();
+}
+
 TEST(small_object, shrink_to_fit) {
     socow_vector<element<size_t>, 3> a;
     a.reserve(5);
@@ -1158,6 +2588,35 @@ TEST(small_object, swap_two_small) {
     EXPECT_EQ(3, b[0]);
 }
 
+TEST(small_object, swap_two_small_throw) {
+    {
+        socow_vector<element<size_t>, 3> a;
+        a.push_back(1);
+        a.push_back(2);
+
+        socow_vector<element<size_t>, 3> b;
+        b.push_back(3);
+
+        element<size_t>::set_throw_countdown(4);
+        EXPECT_THROW(a.swap(b), std::runtime_error);
+        EXPECT_EQ(1, a.size());
+        EXPECT_EQ(3, a[0]);
+        EXPECT_EQ(0, b.size());
+    }
+    element<size_t>::expect_no_instances();
+
+    // relocation cannot throw, so nothing is copied
+    socow_vector<relocatable, 3> a(2, relocatable(1));
+    socow_vector<relocatable, 3> b(1, relocatable(2));
+    relocatable::copies = 0;
+    a.swap(b);
+    EXPECT_EQ(0, relocatable::copies);
+    EXPECT_EQ(1, a.size());
+    EXPECT_EQ(2, b.size());
+    EXPECT_EQ(2, as_const(a)[0].val);
+    EXPECT_EQ(1, as_const(b)[1].val);
+}
+
 TEST(small_object, swap_big_and_small) {
     socow_vector<element<size_t>, 3> a;
     a.push_back(1);
@@ -1242,6 +2701,42 @@ TEST(small_object, swap_two_big) {
     EXPECT_EQ(7, b[2]);
 }
 
+TEST(small_object, trivially_copyable) {
+    struct point {
+        int x, y;
+    };
+    socow_vector<point, 3> a;
+    for (int i = 0; i != 100; ++i)
+        a.push_back({i, -i});
+
+    socow_vector<point, 3> b = a;
+    b[0].x = 42;
+    EXPECT_EQ(0, a[0].x);
+    EXPECT_EQ(42, b[0].x);
+
+    socow_vector<point, 3> c;
+    c.push_back({7, 8});
+    c.swap(b);
+    EXPECT_EQ(1, b.size());
+    EXPECT_EQ(7, b[0].x);
+    EXPECT_EQ(100, c.size());
+    EXPECT_EQ(-99, c[99].y);
+
+    socow_vector<point, 3> d;
+    d.push_back({1, 2});
+    d.push_back({3, 4});
+    d.swap(b);
+    EXPECT_EQ(2, b.size());
+    EXPECT_EQ(3, b[1].x);
+    EXPECT_EQ(7, d[0].x);
+
+    c.erase(c.begin() + 2, c.end());
+    c.shrink_to_fit();
+    EXPECT_EQ(3, c.capacity());
+    EXPECT_EQ(1, c[1].x);
+    EXPECT_EQ(-1, c[1].y);
+}
+
 TEST(small_object, begin_end) {
     socow_vector<element<size_t>, 3> a;
     a.push_back(1);
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "counted-new.h"
+#include "socow-trace.h"
+#include "socow-vector.h"
+
+// replays a trace written by socow_trace_recorder against several vector
+// configurations and prints the time and the allocations each one takes:
+//   trace_replay <trace file>
+namespace {
+
+// stands in for the traced element types of up to SIZE bytes
+template <size_t SIZE>
+struct blob {
+    std::array<unsigned char, SIZE> bytes{};
+};
+
+constexpr std::array<size_t, 5> SIZE_CLASSES = {4, 8, 16, 32, 64};
+
+size_t size_class(uint16_t element_size) {
+    for (size_t i = 0; i != SIZE_CLASSES.size(); ++i) {
+        if (element_size <= SIZE_CLASSES[i]) {
+            return i;
+        }
+    }
+    return SIZE_CLASSES.size() - 1;
+}
+
+template <template <typename> typename Vector, typename T>
+struct replayer {
+    using vector = Vector<T>;
+
+    // a vector seen for the first time is made up with the size it had
+    vector& get(uint32_t id, uint32_t size) {
+        auto it = vecs_.find(id);
+        if (it == vecs_.end()) {
+            it = vecs_.try_emplace(id, size, T()).first;
+        }
+        return it->second;
+    }
+
+    void create(uint32_t id, vector vec) {
+        vecs_.erase(id);
+        vecs_.try_emplace(id, std::move(vec));
+    }
+
+    void replay(socow_trace_record const& rec) {
+        T const value{};
+        switch (static_cast<socow_op>(rec.op)) {
+        case socow_op::create:
+            create(rec.id, vector());
+            break;
+        case socow_op::copy:
+            create(rec.id, get(rec.other, rec.size));
+            break;
+        case socow_op::move:
+            create(rec.id, std::move(get(rec.other, 0)));
+            break;
+        case socow_op::assign:
+            if (rec.other != 0) {
+                get(rec.id, rec.size) = get(rec.other, 0);
+            } else {
+                get(rec.id, rec.size).assign(rec.count, value);
+            }
+            break;
+        case socow_op::move_assign:
+            get(rec.id, rec.size) = std::move(get(rec.other, 0));
+            break;
+        case socow_op::destroy:
+            vecs_.erase(rec.id);
+            break;
+        case socow_op::write:
+            static_cast<void>(get(rec.id, rec.size).data());
+            break;
+        case socow_op::append: {
+            vector& vec = get(rec.id, rec.size);
+            for (uint32_t i = 0; i != rec.count; ++i) {
+                vec.push_back(value);
+            }
+            break;
+        }
+        case socow_op::pop: {
+            vector& vec = get(rec.id, rec.size);
+            if (!vec.empty()) {
+                vec.pop_back();
+            }
+            break;
+        }
+        case socow_op::insert: {
+            vector& vec = get(rec.id, rec.size);
+            size_t pos = std::min<size_t>(rec.pos, vec.size());
+            vec.insert(std::as_const(vec).begin() + pos, rec.count, value);
+            break;
+        }
+        case socow_op::erase: {
+            vector& vec = get(rec.id, rec.size);
+            size_t pos = std::min<size_t>(rec.pos, vec.size());
+            size_t cnt = std::min<size_t>(rec.count, vec.size() - pos);
+            auto first = std::as_const(vec).begin() + pos;
+            vec.erase(first, first + cnt);
+            break;
+        }
+        case socow_op::resize:
+            get(rec.id, rec.size).resize(rec.count);
+            break;
+        case socow_op::reserve:
+            get(rec.id, rec.size).reserve(rec.count);
+            break;
+        case socow_op::shrink:
+            get(rec.id, rec.size).shrink_to_fit();
+            break;
+        case socow_op::clear:
+            get(rec.id, rec.size).clear();
+            break;
+        case socow_op::swap:
+            get(rec.id, rec.size).swap(get(rec.other, 0));
+            break;
+        }
+    }
+
+private:
+    std::unordered_map<uint32_t, vector> vecs_;
+};
+
+template <template <typename> typename Vector>
+void replay_all(char const* name,
+                std::vector<socow_trace_record> const& records) {
+    counted_new_stats before = counted_new;
+    auto start = std::chrono::steady_clock::now();
+    {
+        replayer<Vector, blob<4>> r4;
+        replayer<Vector, blob<8>> r8;
+        replayer<Vector, blob<16>> r16;
+        replayer<Vector, blob<32>> r32;
+        replayer<Vector, blob<64>> r64;
+        for (socow_trace_record const& rec : records) {
+            switch (size_class(rec.element_size)) {
+            case 0:
+                r4.replay(rec);
+                break;
+            case 1:
+                r8.replay(rec);
+                break;
+            case 2:
+                r16.replay(rec);
+                break;
+            case 3:
+                r32.replay(rec);
+                break;
+            default:
+                r64.replay(rec);
+                break;
+            }
+        }
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::printf("%-30s %12.3f %10zu %14zu\n", name, elapsed.count(),
+                counted_new.allocs - before.allocs,
+                counted_new.bytes - before.bytes);
+}
+
+template <typename T>
+using std_vector = std::vector<T>;
+
+template <size_t SMALL_SIZE, typename Policy = socow_default_policy>
+struct socow {
+    template <typename T>
+    using type = socow_vector<T, SMALL_SIZE, Policy>;
+};
+
+std::vector<socow_trace_record> read_trace(std::FILE* file) {
+    socow_trace_header header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+        std::memcmp(header.magic, socow_trace_header::MAGIC,
+                    sizeof(header.magic)) != 0 ||
+        header.version != socow_trace_header::VERSION ||
+        header.record_size != sizeof(socow_trace_record)) {
+        throw std::runtime_error("not a socow_vector trace");
+    }
+    std::vector<socow_trace_record> records;
+    socow_trace_record rec;
+    for (;;) {
+        size_t got = std::fread(&rec, 1, sizeof(rec), file);
+        if (got == 0) {
+            break;
+        }
+        if (got != sizeof(rec)) {
+            throw std::runtime_error("truncated trace");
+        }
+        records.push_back(rec);
+    }
+    if (std::ferror(file)) {
+        throw std::runtime_error("read error");
+    }
+    return records;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 2;
+    }
+    std::FILE* file = std::fopen(argv[1], "rb");
+    if (file == nullptr) {
+        std::perror(argv[1]);
+        return 1;
+    }
+    std::vector<socow_trace_record> records;
+    try {
+        records = read_trace(file);
+    } catch (std::exception const& e) {
+        std::fprintf(stderr, "%s: %s\n", argv[1], e.what());
+        std::fclose(file);
+        return 1;
+    }
+    std::fclose(file);
+
+    std::printf("%zu operations\n", records.size());
+    std::printf("%-30s %12s %10s %14s\n", "configuration", "time, ms",
+                "allocs", "alloc bytes");
+    replay_all<std_vector>("std::vector", records);
+    replay_all<socow<1>::type>("socow_vector<1>", records);
+    replay_all<socow<4>::type>("socow_vector<4>", records);
+    replay_all<socow<16>::type>("socow_vector<16>", records);
+    replay_all<socow<64>::type>("socow_vector<64>", records);
+    replay_all<socow<4, socow_pooled_policy>::type>("socow_vector<4>, pooled",
+                                                    records);
+    replay_all<socow<4, socow_growth_policy<3, 2>>::type>(
+        "socow_vector<4>, growth 3/2", records);
+    replay_all<socow<4, socow_unshare_keep_policy<>>::type>(
+        "socow_vector<4>, unshare keep", records);
+    return 0;
+}